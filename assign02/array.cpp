@@ -1,17 +1,340 @@
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <thread>
 #include "array.h"
 #include "exceptions.h"
+#include "string.h"
 #include "valrep.h"
 
-Array::Array(std::vector<Value> arr) 
-  : ValRep(VALREP_ARRAY)
-  , arr(arr) {
+namespace {
 
+// arrays with at least this many elements are sorted in parallel
+const size_t PARALLEL_SORT_MIN = 1 << 16;
+const unsigned MAX_SORT_THREADS = 8;
+
+// Call fn(0), ..., fn(n - 1) on n threads (one of them this one)
+template<typename Fn>
+void run_parallel(unsigned n, Fn fn) {
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i + 1 < n; i++) {
+    threads.emplace_back(fn, i);
+  }
+  fn(n - 1);
+  for (auto i = threads.begin(); i != threads.end(); ++i) {
+    i->join();
+  }
+}
+
+// Sort the elements in [begin, end). A large range is split in to
+// a power of two parts, which are sorted concurrently and then
+// merged pairwise (with the merges at each level concurrent too).
+template<typename T, typename Less>
+void parallel_sort(T *begin, T *end, Less less) {
+  size_t n = size_t(end - begin);
+  unsigned num_parts = std::min(std::thread::hardware_concurrency(), MAX_SORT_THREADS);
+  if (n < PARALLEL_SORT_MIN || num_parts < 2) {
+    std::sort(begin, end, less);
+    return;
+  }
+  while ((num_parts & (num_parts - 1)) != 0) {
+    num_parts &= num_parts - 1;
+  }
+
+  std::vector<T *> bounds(num_parts + 1);
+  for (unsigned i = 0; i <= num_parts; i++) {
+    bounds[i] = begin + n * i / num_parts;
+  }
+
+  run_parallel(num_parts, [&](unsigned i) {
+    std::sort(bounds[i], bounds[i + 1], less);
+  });
+  for (unsigned width = 1; width < num_parts; width *= 2) {
+    run_parallel(num_parts / (2 * width), [&](unsigned i) {
+      unsigned first = 2 * i * width;
+      std::inplace_merge(bounds[first], bounds[first + width], bounds[first + 2 * width], less);
+    });
+  }
+}
+
+// The (wrapping) sum of n packed ints
+int sum_int32(const int32_t *ints, size_t n) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += uint32_t(ints[i]);
+  }
+  return int32_t(sum);
+}
+
+// The index of the first packed int equal to val, or -1 (checked
+// a block at a time, like Value::find_identical(), but 32 bit
+// compares vectorize everywhere)
+long find_int32(const int32_t *ints, size_t n, int32_t val) {
+  const size_t BLOCK = 16;
+  size_t i = 0;
+  for (; i + BLOCK <= n; i += BLOCK) {
+    unsigned matches = 0;
+    for (size_t j = 0; j < BLOCK; j++) {
+      matches |= unsigned(ints[i + j] == val);
+    }
+    if (matches != 0) {
+      break;
+    }
+  }
+  for (; i < n; i++) {
+    if (ints[i] == val) {
+      return long(i);
+    }
+  }
+  return -1;
+}
+
+}
+
+Array::Storage::Storage(std::vector<Value> &&elts)
+  : refcount(0)
+  , gc_epoch(0)
+  , packed(Value::all_int(elts.data(), elts.size())) {
+  if (packed) {
+    ints.resize(elts.size());
+    for (size_t i = 0; i < elts.size(); i++) {
+      ints[i] = elts[i].get_ival();
+    }
+  } else {
+    elements = std::move(elts);
+  }
+}
+
+Array::Storage::Storage(std::vector<int32_t> &&ints_)
+  : refcount(0)
+  , gc_epoch(0)
+  , packed(true)
+  , ints(std::move(ints_)) {
+}
+
+size_t Array::Storage::get_num_bytes() const {
+  return sizeof(Storage) + ints.capacity() * sizeof(int32_t) + elements.capacity() * sizeof(Value);
+}
+
+Array::Array(std::vector<Value> arr)
+  : Array(new Storage(std::move(arr))) {
+}
+
+Array::Array(std::vector<int32_t> ints)
+  : Array(new Storage(std::move(ints))) {
+}
+
+// New storage (with no references yet) is counted towards the
+// size of the heap, shared storage isn't
+Array::Array(Storage *storage)
+  : ValRep(VALREP_ARRAY, sizeof(Array) + (storage->refcount == 0 ? storage->get_num_bytes() : 0))
+  , m_storage(storage) {
+  m_storage->refcount++;
 }
 
 Array::~Array() {
+  if (--m_storage->refcount == 0) {
+    delete m_storage;
+  }
+}
 
+// Arrays sharing storage only need to mark its elements once
+// (and packed elements don't need to be marked at all)
+void Array::trace(Heap &heap) const {
+  if (heap.claim(m_storage->gc_epoch, m_storage->get_num_bytes())) {
+    const std::vector<Value> &elements = m_storage->elements;
+    for (auto i = elements.begin(); i != elements.end(); ++i) {
+      heap.mark_value(*i);
+    }
+  }
+}
+
+Array *Array::copy_elements() const {
+  if (m_storage->packed) {
+    return new Array(std::vector<int32_t>(m_storage->ints));
+  }
+  return new Array(std::vector<Value>(m_storage->elements));
+}
+
+void Array::push_val(Value val) {
+  Storage *storage = mutable_storage();
+  if (storage->packed && val.get_kind() == VALUE_INT) {
+    storage->ints.push_back(val.get_ival());
+  } else {
+    mutable_elements().push_back(val);
+  }
 }
 
 void Array::set_val(Value val, int ind) {
-  arr[ind] = val;
-}
\ No newline at end of file
+  Storage *storage = mutable_storage();
+  if (storage->packed && val.get_kind() == VALUE_INT) {
+    storage->ints[ind] = val.get_ival();
+  } else {
+    mutable_elements()[ind] = val;
+  }
+}
+
+void Array::pop_val() {
+  Storage *storage = mutable_storage();
+  if (storage->packed) {
+    storage->ints.pop_back();
+  } else {
+    storage->elements.pop_back();
+  }
+}
+
+std::string Array::as_str() const {
+  std::string cur = "[";
+
+  if (m_storage->packed) {
+    const std::vector<int32_t> &ints = m_storage->ints;
+    char buf[16];
+    for (size_t i = 0; i < ints.size(); i++) {
+      if (i > 0) {
+        cur += ", ";
+      }
+      cur.append(buf, std::to_chars(buf, buf + sizeof(buf), ints[i]).ptr);
+    }
+  } else {
+    const std::vector<Value> &elements = m_storage->elements;
+    for (size_t i = 0; i < elements.size(); i++) {
+      if (i > 0) {
+        cur += ", ";
+      }
+      cur += elements[i].as_str();
+    }
+  }
+
+  cur += "]";
+  return cur;
+}
+
+// Give this Array its own copy of shared storage
+void Array::detach() {
+  Storage *shared = m_storage;
+  m_storage = shared->packed ? new Storage(std::vector<int32_t>(shared->ints))
+                             : new Storage(std::vector<Value>(shared->elements));
+  m_storage->refcount++;
+  shared->refcount--;
+}
+
+std::vector<Value> &Array::mutable_elements() {
+  Storage *storage = mutable_storage();
+  if (storage->packed) {
+    std::vector<Value> elements(storage->ints.begin(), storage->ints.end());
+    storage->elements.swap(elements);
+    std::vector<int32_t>().swap(storage->ints);
+    storage->packed = false;
+  }
+  return storage->elements;
+}
+
+bool Array::is_all_int() const {
+  return m_storage->packed || Value::all_int(m_storage->elements.data(), m_storage->elements.size());
+}
+
+bool Array::is_all_string() const {
+  if (m_storage->packed) {
+    return m_storage->ints.empty();
+  }
+  const std::vector<Value> &elements = m_storage->elements;
+  for (auto i = elements.begin(); i != elements.end(); ++i) {
+    if (i->get_kind() != VALUE_STRING) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int Array::sum_ints() const {
+  if (m_storage->packed) {
+    return sum_int32(m_storage->ints.data(), m_storage->ints.size());
+  }
+  return Value::sum_ints(m_storage->elements.data(), m_storage->elements.size());
+}
+
+int Array::index_of(const Value &val) const {
+  if (m_storage->packed) {
+    if (val.get_kind() != VALUE_INT) {
+      return -1;
+    }
+    return int(find_int32(m_storage->ints.data(), m_storage->ints.size(), val.get_ival()));
+  }
+
+  const std::vector<Value> &elements = m_storage->elements;
+  if (val.get_kind() != VALUE_STRING) {
+    return int(Value::find_identical(elements.data(), elements.size(), val));
+  }
+
+  const String *str = val.get_string();
+  for (size_t i = 0; i < elements.size(); i++) {
+    if (elements[i].get_kind() == VALUE_STRING && elements[i].get_string()->compare(str) == 0) {
+      return int(i);
+    }
+  }
+  return -1;
+}
+
+// Filling with an int leaves (or makes) the array packed
+void Array::fill(const Value &val) {
+  Storage *storage = mutable_storage();
+  if (val.get_kind() == VALUE_INT) {
+    if (!storage->packed) {
+      storage->ints.resize(storage->elements.size());
+      std::vector<Value>().swap(storage->elements);
+      storage->packed = true;
+    }
+    std::fill(storage->ints.begin(), storage->ints.end(), val.get_ival());
+  } else {
+    std::vector<Value> &elements = mutable_elements();
+    std::fill(elements.begin(), elements.end(), val);
+  }
+}
+
+void Array::reverse() {
+  Storage *storage = mutable_storage();
+  if (storage->packed) {
+    std::reverse(storage->ints.begin(), storage->ints.end());
+  } else {
+    std::reverse(storage->elements.begin(), storage->elements.end());
+  }
+}
+
+void Array::sort_ints() {
+  Storage *storage = mutable_storage();
+  if (storage->packed) {
+    std::vector<int32_t> &ints = storage->ints;
+    parallel_sort(ints.data(), ints.data() + ints.size(), std::less<int32_t>());
+  } else {
+    std::vector<Value> &elements = storage->elements;
+    parallel_sort(elements.data(), elements.data() + elements.size(), Value::int_less);
+  }
+}
+
+void Array::sort_strings() {
+  std::vector<Value> &elements = mutable_elements();
+  parallel_sort(elements.data(), elements.data() + elements.size(), [](const Value &a, const Value &b) {
+    return a.get_string()->compare(b.get_string()) < 0;
+  });
+}
+
+Array *Array::slice(int ind, int count) const {
+  assert(ind >= 0 && count >= 0 && ind + count <= len());
+  if (ind == 0 && count == len()) {
+    return new Array(m_storage);
+  }
+  if (m_storage->packed) {
+    auto first = m_storage->ints.begin() + ind;
+    return new Array(std::vector<int32_t>(first, first + count));
+  }
+  auto first = m_storage->elements.begin() + ind;
+  return new Array(std::vector<Value>(first, first + count));
+}
+
+Array *Array::range(int start, int end) {
+  std::vector<int32_t> ints(end > start ? size_t(int64_t(end) - start) : 0);
+  for (size_t i = 0; i < ints.size(); i++) {
+    ints[i] = int32_t(start + int64_t(i));
+  }
+  return new Array(std::move(ints));
+}
@@ -1,15 +1,43 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include <cstdint>
 #include <vector>
+#include <utility>
 #include <string>
 #include "valrep.h"
 #include "value.h"
 
+// The elements of an Array are kept in a separately reference counted
+// buffer. Arrays are passed by reference, so the only Arrays that share
+// a buffer are a whole-array slice() and the array it was taken from,
+// until one of them is modified (copy-on-write).
+//
+// An array whose elements are all ints is "packed": the elements are
+// stored as plain int32_t values (half the size of a Value, and with
+// no kinds to check). Storing anything other than an int in a packed
+// array converts it to an array of Values (which it stays, unless
+// it is filled with an int).
 class Array : public ValRep {
 private:
+  struct Storage {
+    int refcount;
+    unsigned gc_epoch;  // see Heap::claim()
+    bool packed;
+    std::vector<int32_t> ints;    // the elements, if packed
+    std::vector<Value> elements;  // the elements, if not
 
-  std::vector<Value> arr;
+    // (packed if all of the elements are ints)
+    Storage(std::vector<Value> &&elts);
+    Storage(std::vector<int32_t> &&ints_);
+
+    size_t size() const { return packed ? ints.size() : elements.size(); }
+    size_t get_num_bytes() const;
+  };
+
+  Storage *m_storage;
+
+  Array(Storage *storage);
 
   // value semantics prohibited
   Array(const Array &);
@@ -17,14 +45,61 @@ private:
 
 public:
   Array(std::vector<Value> arr);
+  Array(std::vector<int32_t> ints);
   virtual ~Array();
 
-  std::vector<Value> get_array() const { return arr; }
-  void push_val(Value val) { arr.push_back(val); }
+  virtual void trace(Heap &heap) const;
+  virtual size_t get_size() const { return sizeof(Array); }
+
+  // Return a new Array with its own copy of the elements (so it can
+  // be used by another heap: see ValueCopier)
+  Array *copy_elements() const;
+
+  bool is_packed() const { return m_storage->packed; }
+  int len() const { return int(m_storage->size()); }
+  bool is_empty() const { return m_storage->size() == 0; }
+  Value get_val(int ind) const {
+    return m_storage->packed ? Value(m_storage->ints.at(ind)) : m_storage->elements.at(ind);
+  }
+
+  void push_val(Value val);
   void set_val(Value val, int ind);
-  void pop_val() { arr.pop_back(); }
-  int len() { return arr.size(); }
-  Value get_val(int ind) { return arr.at(ind); }
+  void pop_val();
+
+  // the printed form of the array, e.g. "[1, 2, 3]"
+  std::string as_str() const;
+
+  // Bulk operations, used by the array intrinsics (sum, fill, etc.)
+  bool is_all_int() const;
+  bool is_all_string() const;
+  // the sum of the elements, which must all be ints
+  int sum_ints() const;
+  // the index of the first element equal to val (the same int,
+  // a string with the same characters, or the same object), or -1
+  int index_of(const Value &val) const;
+  void fill(const Value &val);
+  void reverse();
+  // Sort an array of ints or of strings (large arrays are sorted
+  // on several threads)
+  void sort_ints();
+  void sort_strings();
+  // a new Array with count elements starting at ind (which
+  // must be in range); a slice of the whole array shares its storage
+  Array *slice(int ind, int count) const;
+  // a new Array with the ints start, start + 1, ..., end - 1
+  static Array *range(int start, int end);
+
+private:
+  // the storage, made unique to this Array before being modified
+  Storage *mutable_storage() {
+    if (m_storage->refcount > 1) {
+      detach();
+    }
+    return m_storage;
+  }
+  // the storage as Values, converting it if it is packed
+  std::vector<Value> &mutable_elements();
+  void detach();
 };
 
 #endif // ARRAY_H
@@ -61,6 +61,26 @@ std::string ASTTreePrint::node_tag_to_string(int tag) const {
     return "FUNC";
   case AST_STRING:
     return "STRING";
+  case AST_ADD_INT:
+    return "ADD_INT";
+  case AST_SUB_INT:
+    return "SUB_INT";
+  case AST_MULTIPLY_INT:
+    return "MULTIPLY_INT";
+  case AST_DIVIDE_INT:
+    return "DIVIDE_INT";
+  case AST_LT_INT:
+    return "LT_INT";
+  case AST_LTE_INT:
+    return "LTE_INT";
+  case AST_GT_INT:
+    return "GT_INT";
+  case AST_GTE_INT:
+    return "GTE_INT";
+  case AST_EQ_INT:
+    return "EQ_INT";
+  case AST_NOT_EQ_INT:
+    return "NOT_EQ_INT";
   default:
     RuntimeError::raise("Unknown AST node type %d\n", tag);
   }
@@ -31,8 +31,22 @@ enum ASTKind {
   AST_WHILE,
   AST_FNCALL,
   AST_ARGLIST,
-  AST_STRING
+  AST_STRING,
   // add members for other AST node kinds
+
+  // quickened forms of the int operators, which the tree-walking
+  // evaluator rewrites AST_ADD ... AST_NOT_EQ nodes in to once they
+  // have been executed (see Interpreter::quicken())
+  AST_ADD_INT,
+  AST_SUB_INT,
+  AST_MULTIPLY_INT,
+  AST_DIVIDE_INT,
+  AST_LT_INT,
+  AST_LTE_INT,
+  AST_GT_INT,
+  AST_GTE_INT,
+  AST_EQ_INT,
+  AST_NOT_EQ_INT
 };
 
 class ASTTreePrint : public TreePrint {
@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include "ast.h"
+#include "binary_io.h"
+#include "cpputil.h"
+#include "exceptions.h"
+#include "input_buffer.h"
+#include "location.h"
+#include "node.h"
+#include "ast_cache.h"
+
+namespace {
+
+// identifies the format (the last byte is the version)
+const char MAGIC[4] = { 'M', 'L', 'A', 1 };
+// saved ASTs are only used by a build with the same tags
+const uint64_t NUM_TAGS = AST_NOT_EQ_INT + 1;
+
+using binary_io::Reader;
+using binary_io::write_int;
+using binary_io::write_varint;
+
+}
+
+ASTCache::ASTCache(const std::string &dir)
+  : m_dir(dir) {
+}
+
+ASTCache::~ASTCache() {
+}
+
+uint64_t ASTCache::hash_source(const char *data, size_t size) {
+  return binary_io::fnv1a(data, size);
+}
+
+Node *ASTCache::load(uint64_t hash, size_t size, const std::string &filename) const {
+  std::string path = get_path(hash);
+  FILE *in = fopen(path.c_str(), "rb");
+  if (in == nullptr) {
+    return nullptr;
+  }
+  std::unique_ptr<InputBuffer> data;
+  try {
+    data.reset(new InputBuffer(in, path));
+  } catch (RuntimeError &) {
+    // (unreadable entries are ignored)
+  }
+  fclose(in);
+  return data != nullptr ? deserialize(data->begin(), data->size(), hash, size, filename) : nullptr;
+}
+
+void ASTCache::store(uint64_t hash, size_t size, const Node *ast) const {
+  std::string data = serialize(ast, hash, size);
+
+  // written to a temporary file (unique to this process and call)
+  // and renamed, so that a reader never sees part of an entry
+  static std::atomic<unsigned> s_num_stored(0);
+  std::string path = get_path(hash);
+  std::string temp_path = cpputil::format("%s.%d.%u.tmp", path.c_str(), int(getpid()), s_num_stored++);
+  FILE *out = fopen(temp_path.c_str(), "wb");
+  if (out == nullptr) {
+    return;
+  }
+  bool written = fwrite(data.data(), 1, data.size(), out) == data.size();
+  written = fclose(out) == 0 && written;
+  if (!written || rename(temp_path.c_str(), path.c_str()) != 0) {
+    remove(temp_path.c_str());
+  }
+}
+
+std::string ASTCache::serialize(const Node *ast, uint64_t hash, size_t size) {
+  std::vector<const Node *> nodes;
+  const_cast<Node *>(ast)->preorder([&](Node *node) {
+    nodes.push_back(node);
+  });
+
+  // the string table is in order of use (most used first), so that
+  // most nodes refer to their string with a single byte
+  std::unordered_map<std::string, uint64_t> string_index;
+  std::vector<std::string> node_strs(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    node_strs[i] = nodes[i]->get_str();
+    string_index[node_strs[i]]++;
+  }
+  std::vector<std::pair<uint64_t, const std::string *>> strings;
+  for (auto i = string_index.begin(); i != string_index.end(); ++i) {
+    strings.emplace_back(i->second, &i->first);
+  }
+  std::sort(strings.begin(), strings.end(), [](const std::pair<uint64_t, const std::string *> &a,
+                                               const std::pair<uint64_t, const std::string *> &b) {
+    return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+  });
+  for (size_t i = 0; i < strings.size(); i++) {
+    string_index[*strings[i].second] = i;
+  }
+
+  std::string out(MAGIC, sizeof(MAGIC));
+  write_varint(out, NUM_TAGS);
+  write_varint(out, hash);
+  write_varint(out, size);
+
+  write_varint(out, strings.size());
+  for (auto i = strings.begin(); i != strings.end(); ++i) {
+    write_varint(out, i->second->size());
+    out += *i->second;
+  }
+
+  write_varint(out, nodes.size());
+  int prev_line = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const Node *node = nodes[i];
+    const Location &loc = node->get_loc();
+    // the tag and (up to 3) children share a varint
+    unsigned num_kids = node->get_num_kids();
+    write_varint(out, uint64_t(node->get_tag()) * 4 + std::min(num_kids, 3u));
+    if (num_kids >= 3) {
+      write_varint(out, num_kids - 3);
+    }
+    write_varint(out, string_index[node_strs[i]]);
+    write_int(out, int64_t(loc.get_line()) - prev_line);
+    write_int(out, loc.get_col());
+    prev_line = loc.get_line();
+  }
+
+  // a checksum of everything else, so that a damaged entry isn't used
+  binary_io::write_checksum(out);
+  return out;
+}
+
+Node *ASTCache::deserialize(const char *data, size_t data_size, uint64_t hash, size_t size, const std::string &filename) {
+  if (data_size < sizeof(MAGIC) + 8 || memcmp(data, MAGIC, sizeof(MAGIC)) != 0 ||
+      !binary_io::has_valid_checksum(data, data_size)) {
+    return nullptr;
+  }
+  size_t body_size = data_size - 8;
+  Reader reader(data, body_size);
+  reader.read_bytes(sizeof(MAGIC));
+  if (reader.read_varint() != NUM_TAGS || reader.read_varint() != hash ||
+      reader.read_varint() != size || !reader.ok()) {
+    return nullptr;
+  }
+
+  std::vector<std::string> strings(size_t(std::min<uint64_t>(reader.read_varint(), body_size)));
+  for (auto i = strings.begin(); i != strings.end(); ++i) {
+    *i = reader.read_bytes(reader.read_varint());
+  }
+
+  // the nodes whose children are still being read (with the number
+  // still to come, and the location to give them once they're done,
+  // since adding children can change a node's location)
+  struct Open {
+    Node *node;
+    uint64_t kids_left;
+    Location loc;
+  };
+  std::vector<Open> open;
+  std::unique_ptr<Node> root;
+  Location file_loc(filename, 0, 0);
+  uint64_t num_nodes = reader.read_varint();
+  int line = 0;
+  for (uint64_t i = 0; i < num_nodes && reader.ok(); i++) {
+    uint64_t tag = reader.read_varint();
+    uint64_t num_kids = tag % 4;
+    tag /= 4;
+    if (num_kids == 3) {
+      num_kids += reader.read_varint();
+    }
+    uint64_t str_index = reader.read_varint();
+    line += int(reader.read_int());
+    int col = int(reader.read_int());
+    if (!reader.ok() || tag > uint64_t(INT_MAX) || str_index >= strings.size() ||
+        (i > 0 && open.empty())) {
+      return nullptr;
+    }
+
+    const std::string &str = strings[str_index];
+    Node *node = new Node(int(tag), str.data(), str.size(), file_loc.at(line, col));
+    node->reserve_kids(unsigned(std::min<uint64_t>(num_kids, body_size)));
+    if (i == 0) {
+      root.reset(node);
+    } else {
+      open.back().node->append_kid(node);
+      open.back().kids_left--;
+    }
+    Open entry = { node, num_kids, file_loc.at(line, col) };
+    open.push_back(entry);
+    while (!open.empty() && open.back().kids_left == 0) {
+      open.back().node->set_loc(open.back().loc);
+      open.pop_back();
+    }
+  }
+
+  if (!reader.ok() || !reader.at_end() || !open.empty() || root == nullptr) {
+    return nullptr;
+  }
+  return root.release();
+}
+
+std::string ASTCache::get_path(uint64_t hash) const {
+  return cpputil::format("%s/%016llx.ast", m_dir.c_str(), static_cast<unsigned long long>(hash));
+}
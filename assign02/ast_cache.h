@@ -0,0 +1,50 @@
+#ifndef AST_CACHE_H
+#define AST_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+class Node;
+
+// An ASTCache saves the ASTs of source files, as built by the parser
+// (before analysis), in a directory, so that running an unchanged
+// file again can skip lexing and parsing. Entries are named after a
+// hash of the source's contents, and hold a compact binary form of
+// the AST: a table of the distinct strings in it, then the nodes in
+// preorder (tag and number of children, string, and location, mostly
+// as one byte varints), then a checksum. The source file name isn't saved: it is supplied
+// when an AST is loaded, so renamed or copied files can share an entry.
+class ASTCache {
+private:
+  std::string m_dir;
+
+  // value semantics prohibited
+  ASTCache(const ASTCache &);
+  ASTCache &operator=(const ASTCache &);
+
+public:
+  // the directory must exist
+  ASTCache(const std::string &dir);
+  ~ASTCache();
+
+  // Hash of a source file's contents (64 bit FNV-1a)
+  static uint64_t hash_source(const char *data, size_t size);
+
+  // The saved AST for the source with this hash and size (with its
+  // locations in filename), or null if there isn't a usable one
+  Node *load(uint64_t hash, size_t size, const std::string &filename) const;
+  // Save an AST. Failing to save it isn't an error, since the cache
+  // is only an optimization.
+  void store(uint64_t hash, size_t size, const Node *ast) const;
+
+  // The binary form of an AST (including the hash and size of its
+  // source), and the AST it describes (null if the data is malformed
+  // or is for different source)
+  static std::string serialize(const Node *ast, uint64_t hash, size_t size);
+  static Node *deserialize(const char *data, size_t data_size, uint64_t hash, size_t size, const std::string &filename);
+
+private:
+  std::string get_path(uint64_t hash) const;
+};
+
+#endif // AST_CACHE_H
@@ -0,0 +1,62 @@
+// Replacements for the global operator new and delete that count
+// allocations. This is linked in to bench/minilang_counted (instead
+// of being part of the interpreter), so counting costs nothing in
+// the normal build. When the program exits, the number of
+// allocations is written to the file named by the
+// MINILANG_ALLOC_COUNT environment variable, if it is set.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<unsigned long> g_num_allocs(0);
+
+void *counted_alloc(size_t size) {
+  g_num_allocs.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size > 0 ? size : 1);
+}
+
+struct Reporter {
+  ~Reporter() {
+    const char *filename = getenv("MINILANG_ALLOC_COUNT");
+    if (filename != nullptr) {
+      FILE *out = fopen(filename, "w");
+      if (out) {
+        fprintf(out, "%lu\n", g_num_allocs.load());
+        fclose(out);
+      }
+    }
+  }
+};
+
+Reporter g_reporter;
+
+}
+
+void *operator new(size_t size) {
+  void *p = counted_alloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_alloc(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
@@ -0,0 +1,146 @@
+// Runs each benchmark script several times with the interpreter,
+// and prints the median and minimum wall time, and the peak resident
+// set size, of the runs. If an interpreter built with alloc_counter.cpp
+// is given (-c), each script is also run once with it to count the
+// number of allocations made.
+//
+// usage: bench_runner [-r runs] [-c counting_minilang] minilang script...
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct RunResult {
+  bool ok;
+  double ms;
+  long max_rss_kb;
+};
+
+// Run the interpreter on the script, with its output discarded
+RunResult run(const char *minilang, const char *script, const char *alloc_count_file) {
+  RunResult result = { false, 0.0, 0 };
+  auto start = std::chrono::steady_clock::now();
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return result;
+  }
+  if (pid == 0) {
+    int devnull = open("/dev/null", O_RDWR);
+    dup2(devnull, 0);
+    dup2(devnull, 1);
+    if (alloc_count_file != nullptr) {
+      setenv("MINILANG_ALLOC_COUNT", alloc_count_file, 1);
+    }
+    execl(minilang, minilang, script, (char *) nullptr);
+    perror(minilang);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0) {
+    perror("wait4");
+    return result;
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  result.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  result.ms = std::chrono::duration<double, std::milli>(end - start).count();
+  result.max_rss_kb = usage.ru_maxrss;
+  return result;
+}
+
+// Count the allocations made by one run of a counting interpreter,
+// returning -1 if the count isn't available
+long count_allocs(const char *minilang, const char *script) {
+  char tmpl[] = "/tmp/bench_allocsXXXXXX";
+  int fd = mkstemp(tmpl);
+  if (fd < 0) {
+    return -1;
+  }
+  close(fd);
+
+  long count = -1;
+  if (run(minilang, script, tmpl).ok) {
+    FILE *in = fopen(tmpl, "r");
+    if (in) {
+      if (fscanf(in, "%ld", &count) != 1) {
+        count = -1;
+      }
+      fclose(in);
+    }
+  }
+  unlink(tmpl);
+  return count;
+}
+
+}
+
+int main(int argc, char **argv) {
+  int num_runs = 5, opt;
+  const char *counting_minilang = nullptr;
+  while ((opt = getopt(argc, argv, "r:c:")) != -1) {
+    switch (opt) {
+    case 'r':
+      num_runs = std::max(1, atoi(optarg));
+      break;
+    case 'c':
+      counting_minilang = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-r runs] [-c counting_minilang] minilang script...\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind + 1 >= argc) {
+    fprintf(stderr, "usage: %s [-r runs] [-c counting_minilang] minilang script...\n", argv[0]);
+    return 1;
+  }
+  const char *minilang = argv[optind];
+
+  printf("%-24s %10s %10s %12s %14s\n", "benchmark", "median ms", "min ms", "peak RSS MB", "allocations");
+  bool all_ok = true;
+  for (int i = optind + 1; i < argc; i++) {
+    const char *script = argv[i];
+    std::vector<double> times;
+    long max_rss_kb = 0;
+    bool ok = true;
+    for (int r = 0; r < num_runs && ok; r++) {
+      RunResult result = run(minilang, script, nullptr);
+      ok = result.ok;
+      times.push_back(result.ms);
+      max_rss_kb = std::max(max_rss_kb, result.max_rss_kb);
+    }
+    if (!ok) {
+      printf("%-24s failed\n", script);
+      all_ok = false;
+      continue;
+    }
+
+    std::sort(times.begin(), times.end());
+    double median = times.size() % 2 == 1 ? times[times.size() / 2]
+                                           : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2.0;
+    std::string allocs = "-";
+    if (counting_minilang != nullptr) {
+      long count = count_allocs(counting_minilang, script);
+      if (count >= 0) {
+        allocs = std::to_string(count);
+      }
+    }
+    printf("%-24s %10.1f %10.1f %12.1f %14s\n", script, median, times[0], max_rss_kb / 1024.0, allocs.c_str());
+    fflush(stdout);
+  }
+
+  return all_ok ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+// Benchmark for the Lexer: tokenizes a script and prints the
+// number of tokens per second. The script is either the file named
+// on the command line, or a generated script of about 8MB of
+// typical minilang code (written to a temporary file, so the Lexer
+// reads it the same way it reads any other source file).
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <unistd.h>
+#include "exceptions.h"
+#include "lexer.h"
+
+namespace {
+
+const int NUM_RUNS = 5;
+
+std::string generate_script(size_t min_size) {
+  std::string script;
+  char buf[512];
+  for (int i = 0; script.size() < min_size; i++) {
+    snprintf(buf, sizeof(buf),
+             "function f%d(a, b) {\n"
+             "  var i, s;\n"
+             "  i = 0; s = \"result %d\";\n"
+             "  while (i < a * 10 + b) {\n"
+             "    if (i >= 100 && b != 0) { s = strcat(s, \"x\"); } else { i = i + 1; }\n"
+             "  }\n"
+             "  s;\n"
+             "}\n", i, i);
+    script += buf;
+  }
+  return script;
+}
+
+}
+
+int main(int argc, char **argv) {
+  std::string filename;
+  bool temp = false;
+  if (argc > 1) {
+    filename = argv[1];
+  } else {
+    char tmpl[] = "/tmp/lexer_benchXXXXXX";
+    int fd = mkstemp(tmpl);
+    std::string script = generate_script(8 << 20);
+    if (fd < 0 || write(fd, script.data(), script.size()) != ssize_t(script.size())) {
+      fprintf(stderr, "Could not write temporary file\n");
+      return 1;
+    }
+    close(fd);
+    filename = tmpl;
+    temp = true;
+  }
+
+  try {
+    for (int run = 0; run < NUM_RUNS; run++) {
+      FILE *in = fopen(filename.c_str(), "r");
+      if (!in) {
+        RuntimeError::raise("Could not open input file '%s'", filename.c_str());
+      }
+      auto start = std::chrono::steady_clock::now();
+      long num_tokens = 0;
+      {
+        Lexer lexer(in, filename);
+        while (lexer.peek() != nullptr) {
+          delete lexer.next();
+          num_tokens++;
+        }
+      }
+      auto end = std::chrono::steady_clock::now();
+      double secs = std::chrono::duration<double>(end - start).count();
+      printf("run %d: %ld tokens in %.1f ms: %.2f M tokens/s\n",
+             run + 1, num_tokens, secs * 1000.0, num_tokens / secs / 1e6);
+    }
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+  }
+
+  if (temp) {
+    unlink(filename.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,169 @@
+// Microbenchmarks for the basic operations on Value:
+// copying, moving, and destroying atomic and dynamic values,
+// and integer arithmetic. Each benchmark works on a small pool of
+// Values, passes the Value it produces through an opaque barrier on
+// every iteration (so the compiler can't drop or hoist the operation),
+// and prints the average time per operation in nanoseconds.
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <utility>
+#include <vector>
+#include "value.h"
+#include "string.h"
+
+namespace {
+
+const long DEFAULT_ITERS = 50000000;
+const unsigned POOL_SIZE = 64;  // must be a power of 2
+// each benchmark is run this many times, and the fastest run is
+// reported (the others are mostly disturbed by other processes)
+const int RUNS = 5;
+
+// keeps results observable so the loops can't be optimized away
+volatile int g_sink;
+
+// Makes the compiler assume that *p is read and may have been changed,
+// so the store to it (and everything that computed it) has to happen
+inline void barrier(const void *p) {
+#ifdef __GNUC__
+  asm volatile("" : : "r"(p) : "memory");
+#else
+  g_sink = *static_cast<const volatile char *>(p);
+#endif
+}
+
+template<typename Fn>
+void run(const char *name, long iters, Fn fn) {
+  double best = 0;
+  for (int i = 0; i < RUNS; i++) {
+    auto start = std::chrono::steady_clock::now();
+    fn(iters);
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    if (i == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  printf("%-28s %8.2f ns/op\n", name, best / iters);
+}
+
+std::vector<Value> make_int_pool() {
+  std::vector<Value> pool;
+  for (unsigned i = 0; i < POOL_SIZE; i++) {
+    pool.push_back(Value(int(i)));
+  }
+  return pool;
+}
+
+std::vector<Value> make_string_pool() {
+  std::vector<Value> pool;
+  for (unsigned i = 0; i < POOL_SIZE; i++) {
+    pool.push_back(Value(new String("hello")));
+  }
+  return pool;
+}
+
+}
+
+int main(int argc, char **argv) {
+  long iters = argc > 1 ? atol(argv[1]) : DEFAULT_ITERS;
+
+  run("copy assign int", iters, [](long n) {
+    std::vector<Value> pool = make_int_pool();
+    int total = 0;
+    for (long i = 0; i < n; i++) {
+      Value &v = pool[i & (POOL_SIZE - 1)];
+      v = pool[(i + 7) & (POOL_SIZE - 1)];
+      barrier(&v);
+      total += v.get_ival();
+    }
+    g_sink = total;
+  });
+
+  run("copy construct int", iters, [](long n) {
+    std::vector<Value> pool = make_int_pool();
+    int total = 0;
+    for (long i = 0; i < n; i++) {
+      Value v(pool[i & (POOL_SIZE - 1)]);
+      barrier(&v);
+      total += v.get_ival();
+    }
+    g_sink = total;
+  });
+
+  run("copy assign string", iters, [](long n) {
+    std::vector<Value> pool = make_string_pool();
+    int total = 0;
+    for (long i = 0; i < n; i++) {
+      Value &v = pool[i & (POOL_SIZE - 1)];
+      v = pool[(i + 7) & (POOL_SIZE - 1)];
+      barrier(&v);
+      total += int(v.get_kind());
+    }
+    g_sink = total;
+  });
+
+  run("copy construct string", iters, [](long n) {
+    std::vector<Value> pool = make_string_pool();
+    int total = 0;
+    for (long i = 0; i < n; i++) {
+      Value v(pool[i & (POOL_SIZE - 1)]);
+      barrier(&v);
+      total += int(v.get_kind());
+    }
+    g_sink = total;
+  });
+
+  run("move string", iters, [](long n) {
+    std::vector<Value> pool = make_string_pool();
+    Value tmp;
+    int total = 0;
+    // (each iteration is two moves, one each way)
+    for (long i = 0; i < n; i++) {
+      Value &v = pool[i & (POOL_SIZE - 1)];
+      tmp = std::move(v);
+      barrier(&tmp);
+      total += int(tmp.get_kind());
+      v = std::move(tmp);
+      barrier(&v);
+    }
+    g_sink = total;
+  });
+
+  run("int add", iters, [](long n) {
+    std::vector<Value> pool = make_int_pool();
+    for (long i = 0; i < n; i++) {
+      Value &a = pool[i & (POOL_SIZE - 1)], &b = pool[(i + 1) & (POOL_SIZE - 1)];
+      a = Value(a.get_ival() + b.get_ival());
+      barrier(&a);
+    }
+    g_sink = pool[0].get_ival();
+  });
+
+  run("int compare", iters, [](long n) {
+    std::vector<Value> pool = make_int_pool();
+    for (long i = 0; i < n; i++) {
+      Value &a = pool[i & (POOL_SIZE - 1)], &b = pool[(i + 1) & (POOL_SIZE - 1)];
+      a = Value(a.get_ival() < b.get_ival() ? 1 : 0);
+      barrier(&a);
+    }
+    g_sink = pool[0].get_ival();
+  });
+
+  run("vector<Value> push_back", iters, [](long n) {
+    Value s(new String("x"));
+    std::vector<Value> v;
+    for (long i = 0; i < n; i++) {
+      v.push_back(s);
+      barrier(v.data());
+      if (v.size() == 1024) {
+        v.clear();
+      }
+    }
+    g_sink = int(v.size());
+  });
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+#ifndef BINARY_IO_H
+#define BINARY_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Helpers for the binary files written by the interpreter (see
+// ASTCache and Snapshot): unsigned ints as varints (7 bits per byte,
+// low bits first), signed ints zigzag encoded, and a checksum at the
+// end of the data.
+namespace binary_io {
+
+// 64 bit FNV-1a hash
+inline uint64_t fnv1a(const char *data, size_t size) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ uint64_t(static_cast<unsigned char>(data[i]))) * 1099511628211ull;
+  }
+  return h;
+}
+
+inline void write_varint(std::string &out, uint64_t n) {
+  while (n >= 0x80) {
+    out += char(n | 0x80);
+    n >>= 7;
+  }
+  out += char(n);
+}
+
+// ints that may be negative (such as line deltas) are zigzag
+// encoded, so small magnitudes stay small
+inline void write_int(std::string &out, int64_t n) {
+  write_varint(out, (uint64_t(n) << 1) ^ uint64_t(n >> 63));
+}
+
+// Append a checksum of everything written so far
+inline void write_checksum(std::string &out) {
+  uint64_t checksum = fnv1a(out.data(), out.size());
+  for (unsigned i = 0; i < 8; i++) {
+    out += char(checksum >> (8 * i));
+  }
+}
+
+// True if data ends with a checksum of the rest of it
+inline bool has_valid_checksum(const char *data, size_t size) {
+  if (size < 8) {
+    return false;
+  }
+  uint64_t checksum = 0;
+  for (unsigned i = 0; i < 8; i++) {
+    checksum |= uint64_t(static_cast<unsigned char>(data[size - 8 + i])) << (8 * i);
+  }
+  return checksum == fnv1a(data, size - 8);
+}
+
+// Reads the parts of the binary form, checking that they are
+// within the data
+class Reader {
+private:
+  const unsigned char *m_pos, *m_end;
+  bool m_ok;
+
+public:
+  Reader(const char *data, size_t size)
+    : m_pos(reinterpret_cast<const unsigned char *>(data))
+    , m_end(m_pos + size)
+    , m_ok(true) { }
+
+  bool ok() const { return m_ok; }
+  bool at_end() const { return m_pos == m_end; }
+  const char *get_pos() const { return reinterpret_cast<const char *>(m_pos); }
+
+  uint64_t read_varint() {
+    uint64_t n = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (m_pos == m_end) {
+        break;
+      }
+      unsigned char b = *m_pos++;
+      n |= uint64_t(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        return n;
+      }
+    }
+    m_ok = false;
+    return 0;
+  }
+
+  int64_t read_int() {
+    uint64_t n = read_varint();
+    return int64_t(n >> 1) ^ -int64_t(n & 1);
+  }
+
+  std::string read_bytes(uint64_t len) {
+    if (!skip(len)) {
+      return "";
+    }
+    return std::string(reinterpret_cast<const char *>(m_pos - len), size_t(len));
+  }
+
+  // skip len bytes, returning false if there aren't that many
+  bool skip(uint64_t len) {
+    if (len > uint64_t(m_end - m_pos)) {
+      m_ok = false;
+      return false;
+    }
+    m_pos += len;
+    return true;
+  }
+};
+
+}
+
+#endif // BINARY_IO_H
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include "node.h"
+#include "bytecode.h"
+
+namespace {
+
+struct OpcodeInfo {
+  const char *name;
+  int num_operands;
+};
+
+const OpcodeInfo s_opcode_info[NUM_OPCODES] = {
+  { "int", 1 },
+  { "const", 1 },
+  { "pop", 0 },
+  { "load", 2 },
+  { "load_local", 1 },
+  { "load_global", 1 },
+  { "store", 2 },
+  { "store_local", 1 },
+  { "store_global", 1 },
+  { "add", 1 },
+  { "sub", 1 },
+  { "mul", 1 },
+  { "div", 1 },
+  { "lt", 1 },
+  { "lte", 1 },
+  { "gt", 1 },
+  { "gte", 1 },
+  { "eq", 1 },
+  { "ne", 1 },
+  { "and", 2 },
+  { "or", 2 },
+  { "truth", 1 },
+  { "jump", 1 },
+  { "jump_if_false", 2 },
+  { "enter_scope", 2 },
+  { "leave_scope", 0 },
+  { "func", 2 },
+  { "call", 2 },
+  { "return", 0 },
+  { "call_intrinsic1", 1 },
+  { "call_intrinsic2", 1 },
+  { "call_intrinsic3", 1 },
+  { "tail_call", 3 },
+};
+
+}
+
+const char *opcode_name(int op) {
+  return s_opcode_info[op].name;
+}
+
+int opcode_num_operands(int op) {
+  return s_opcode_info[op].num_operands;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Chunk implementation
+////////////////////////////////////////////////////////////////////////
+
+Chunk::Chunk(const std::string &name, const std::vector<std::string> &params, Node *body)
+  : m_name(name)
+  , m_params(params)
+  , m_body(body)
+  , m_max_stack(0)
+  , m_num_locals(0)
+  , m_frame_escapes(true) {
+}
+
+Chunk::~Chunk() {
+}
+
+int Chunk::emit(int word) {
+  m_code.push_back(word);
+  return int(m_code.size()) - 1;
+}
+
+int Chunk::add_constant(const Value &val) {
+  m_constants.push_back(val);
+  return int(m_constants.size()) - 1;
+}
+
+int Chunk::add_node(Node *node) {
+  m_nodes.push_back(node);
+  return int(m_nodes.size()) - 1;
+}
+
+void Chunk::disassemble() const {
+  printf("chunk %s (max stack %d)\n", m_name.c_str(), m_max_stack);
+  unsigned pc = 0;
+  while (pc < m_code.size()) {
+    int op = m_code[pc];
+    printf("  %4u: %-14s", pc, opcode_name(op));
+    for (int i = 1; i <= opcode_num_operands(op); i++) {
+      printf(" %d", m_code[pc + i]);
+    }
+    if (op == OP_CONST) {
+      printf("\t; %s", m_constants[m_code[pc + 1]].as_str().c_str());
+    }
+    printf("\n");
+    pc += 1 + opcode_num_operands(op);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Program implementation
+////////////////////////////////////////////////////////////////////////
+
+Program::Program() {
+}
+
+Program::~Program() {
+  for (auto i = m_chunks.begin(); i != m_chunks.end(); ++i) {
+    delete *i;
+  }
+}
+
+int Program::add_chunk(Chunk *chunk) {
+  m_chunks.push_back(chunk);
+  return int(m_chunks.size()) - 1;
+}
+
+void Program::disassemble() const {
+  for (unsigned i = 0; i < m_chunks.size(); i++) {
+    printf("%u: ", i);
+    m_chunks[i]->disassemble();
+  }
+}
@@ -0,0 +1,131 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <vector>
+#include <string>
+#include "value.h"
+class Node;
+
+// Opcodes for the minilang bytecode. Each instruction is an opcode
+// word followed by zero or more operand words (see get_num_operands()).
+// Operands named "node" are indices into the owning Chunk's node table,
+// and are only used to report errors at the right source location.
+enum Opcode {
+  OP_INT,            // imm            push integer immediate
+  OP_CONST,          // k              push constant k
+  OP_POP,            //                discard top of stack
+  OP_LOAD,           // depth, slot    push value of variable
+  OP_LOAD_LOCAL,     // slot           push value of variable in current scope
+  OP_LOAD_GLOBAL,    // slot           push value of global variable
+  OP_STORE,          // depth, slot    assign top of stack to variable (top is kept)
+  OP_STORE_LOCAL,    // slot
+  OP_STORE_GLOBAL,   // slot
+  OP_ADD,            // node
+  OP_SUB,            // node
+  OP_MUL,            // node
+  OP_DIV,            // node
+  OP_LT,             // node
+  OP_LTE,            // node
+  OP_GT,             // node
+  OP_GTE,            // node
+  OP_EQ,             // node
+  OP_NE,             // node
+  OP_AND,            // node, target   short circuit if top is 0
+  OP_OR,             // node, target   short circuit if top is 1
+  OP_TRUTH,          // node           replace top with (top != 0)
+  OP_JUMP,           // target
+  OP_JUMP_IF_FALSE,  // node, target   pop condition, jump if 0
+  OP_ENTER_SCOPE,    // num_slots, escapes  push a new Environment (from the
+                     //                frame arena unless escapes is set)
+  OP_LEAVE_SCOPE,    //                pop the current Environment
+  OP_FUNC,           // chunk, slot    create a Function and bind it in the current scope
+  OP_CALL,           // argc, node     call function below the arguments
+  OP_RETURN,         //                return top of stack to the caller
+  OP_CALL_INTRINSIC1, // node          call the intrinsic bound to the call node,
+  OP_CALL_INTRINSIC2, // node          with 1, 2, or 3 arguments on the stack
+  OP_CALL_INTRINSIC3, // node
+  OP_TAIL_CALL,      // argc, node, num_scopes  call in tail position: leave the
+                     //                num_scopes block scopes entered by the
+                     //                body, and reuse the current frame
+
+  NUM_OPCODES
+};
+
+// A Chunk is the compiled code for either the top-level unit
+// or the body of one function.
+class Chunk {
+private:
+  std::string m_name;
+  std::vector<std::string> m_params;
+  std::vector<int> m_code;
+  std::vector<Value> m_constants;
+  std::vector<Node *> m_nodes;
+  Node *m_body;
+  int m_max_stack;
+  int m_num_locals;
+  bool m_frame_escapes;
+
+  // value semantics prohibited
+  Chunk(const Chunk &);
+  Chunk &operator=(const Chunk &);
+
+public:
+  Chunk(const std::string &name, const std::vector<std::string> &params, Node *body);
+  ~Chunk();
+
+  const std::string &get_name() const { return m_name; }
+  const std::vector<std::string> &get_params() const { return m_params; }
+  Node *get_body() const { return m_body; }
+
+  const int *get_code() const { return m_code.data(); }
+  unsigned get_code_size() const { return unsigned(m_code.size()); }
+  const Value &get_constant(int index) const { return m_constants[index]; }
+  Node *get_node(int index) const { return m_nodes[index]; }
+
+  int get_max_stack() const { return m_max_stack; }
+  void set_max_stack(int max_stack) { m_max_stack = max_stack; }
+
+  // number of slots in the Environment for the function body
+  int get_num_locals() const { return m_num_locals; }
+  void set_num_locals(int num_locals) { m_num_locals = num_locals; }
+
+  // true if the Environments for a call may be captured by a
+  // Function (so they can't be allocated in the frame arena)
+  bool frame_escapes() const { return m_frame_escapes; }
+  void set_frame_escapes(bool escapes) { m_frame_escapes = escapes; }
+
+  // Functions used by the compiler to build the chunk
+  int emit(int word);
+  void patch(int offset, int word) { m_code[offset] = word; }
+  int add_constant(const Value &val);
+  int add_node(Node *node);
+
+  // print a human-readable listing of the chunk to stdout
+  void disassemble() const;
+};
+
+// A Program is the set of Chunks produced by compiling a unit.
+// Chunk 0 is the top-level unit.
+class Program {
+private:
+  std::vector<Chunk *> m_chunks;
+
+  // value semantics prohibited
+  Program(const Program &);
+  Program &operator=(const Program &);
+
+public:
+  Program();
+  ~Program();
+
+  int add_chunk(Chunk *chunk);
+  Chunk *get_chunk(int index) const { return m_chunks[index]; }
+  unsigned get_num_chunks() const { return unsigned(m_chunks.size()); }
+
+  void disassemble() const;
+};
+
+const char *opcode_name(int op);
+int opcode_num_operands(int op);
+
+#endif // BYTECODE_H
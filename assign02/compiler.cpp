@@ -0,0 +1,334 @@
+#include <cassert>
+#include <string>
+#include "ast.h"
+#include "node.h"
+#include "intrinsic.h"
+#include "compiler.h"
+
+Compiler::Compiler(Program *program)
+  : m_program(program)
+  , m_chunk(nullptr)
+  , m_cur_stack(0)
+  , m_scope_depth(0)
+  , m_body_scope_depth(0) {
+}
+
+Compiler::~Compiler() {
+}
+
+void Compiler::compile_unit(Node *unit) {
+  assert(m_program->get_num_chunks() == 0);
+  m_chunk = new Chunk("<unit>", std::vector<std::string>(), unit);
+  m_program->add_chunk(m_chunk);
+  m_cur_stack = 0;
+  m_scope_depth = 0;
+
+  compile_node(unit);
+  emit_op(OP_RETURN, -1);
+}
+
+// Compile the body of a function into a new Chunk, returning
+// the index of the chunk in the Program
+int Compiler::compile_function(Node *func) {
+  std::string name = func->get_kid(0)->get_str();
+  std::vector<std::string> params;
+  if (func->get_num_kids() == 3) {
+    Node *plist = func->get_kid(1);
+    for (auto i = plist->cbegin(); i != plist->cend(); ++i) {
+      params.push_back((*i)->get_str());
+    }
+  }
+
+  Chunk *saved_chunk = m_chunk;
+  int saved_stack = m_cur_stack;
+  int saved_scope_depth = m_scope_depth;
+  int saved_body_scope_depth = m_body_scope_depth;
+
+  Node *body = func->get_last_kid();
+  m_chunk = new Chunk(name, params, body);
+  m_chunk->set_num_locals(body->get_num_slots());
+  m_chunk->set_frame_escapes(body->frame_escapes());
+  int index = m_program->add_chunk(m_chunk);
+  m_cur_stack = 0;
+  // the body runs two scopes (parameters, then locals) below
+  // the scope where the function is defined
+  m_scope_depth += 2;
+  m_body_scope_depth = m_scope_depth;
+
+  compile_node(body);
+  emit_op(OP_RETURN, -1);
+
+  m_chunk = saved_chunk;
+  m_cur_stack = saved_stack;
+  m_scope_depth = saved_scope_depth;
+  m_body_scope_depth = saved_body_scope_depth;
+  return index;
+}
+
+// Compile a node so that exactly one value (the node's value)
+// is left on the stack
+void Compiler::compile_node(Node *node) {
+  switch (node->get_tag()) {
+  case AST_UNIT:
+  case AST_STATEMENT:
+  case AST_STATEMENT_LIST:
+  case AST_PARAMETER_LIST:
+    compile_sequence(node);
+    return;
+
+  case AST_STRING:
+    emit_op(OP_CONST, 1);
+    emit_operand(m_chunk->add_constant(node->get_literal()));
+    return;
+
+  case AST_INT_LITERAL:
+    emit_op(OP_INT, 1);
+    emit_operand(node->get_literal().get_ival());
+    return;
+
+  case AST_VARREF:
+    compile_load(node);
+    return;
+
+  case AST_VARDEF:
+    // the variable's slot is allocated when the scope is entered
+    // (and set to 0), unless the variable replaces an intrinsic
+    emit_op(OP_INT, 1);
+    emit_operand(0);
+    if (node->has_lexical_address()) {
+      emit_op(OP_STORE_GLOBAL, 0);
+      emit_operand(node->get_slot());
+    }
+    return;
+
+  case AST_ASSIGN:
+    compile_node(node->get_kid(1));
+    compile_store(node->get_kid(0));
+    return;
+
+  case AST_ADD:      compile_binary(node, OP_ADD); return;
+  case AST_SUB:      compile_binary(node, OP_SUB); return;
+  case AST_MULTIPLY: compile_binary(node, OP_MUL); return;
+  case AST_DIVIDE:   compile_binary(node, OP_DIV); return;
+  case AST_LT:       compile_binary(node, OP_LT); return;
+  case AST_LTE:      compile_binary(node, OP_LTE); return;
+  case AST_GT:       compile_binary(node, OP_GT); return;
+  case AST_GTE:      compile_binary(node, OP_GTE); return;
+  case AST_EQ:       compile_binary(node, OP_EQ); return;
+  case AST_NOT_EQ:   compile_binary(node, OP_NE); return;
+
+  case AST_LOGICAL_AND: compile_logical(node, OP_AND); return;
+  case AST_LOGICAL_OR:  compile_logical(node, OP_OR); return;
+
+  case AST_IF:
+    compile_if(node);
+    return;
+
+  case AST_WHILE:
+    compile_while(node);
+    return;
+
+  case AST_FNCALL:
+    compile_call(node);
+    return;
+
+  case AST_FUNC: {
+    int index = compile_function(node);
+    emit_op(OP_FUNC, 1);
+    emit_operand(index);
+    emit_operand(node->get_kid(0)->get_slot());
+    return;
+  }
+
+  default:
+    emit_op(OP_INT, 1);
+    emit_operand(0);
+    return;
+  }
+}
+
+// The value of a sequence is the value of its last element
+// (or 0 if it is empty)
+void Compiler::compile_sequence(Node *node) {
+  if (node->get_num_kids() == 0) {
+    emit_op(OP_INT, 1);
+    emit_operand(0);
+    return;
+  }
+
+  for (auto i = node->cbegin(); i != node->cend(); ++i) {
+    compile_node(*i);
+    if (i + 1 != node->cend()) {
+      emit_op(OP_POP, -1);
+    }
+  }
+}
+
+void Compiler::compile_binary(Node *node, Opcode op) {
+  compile_node(node->get_kid(0));
+  compile_node(node->get_kid(1));
+  emit_op(op, -1);
+  emit_operand(m_chunk->add_node(node));
+}
+
+void Compiler::compile_logical(Node *node, Opcode op) {
+  int node_index = m_chunk->add_node(node);
+
+  compile_node(node->get_kid(0));
+
+  // if the operation short circuits, the result replaces the left
+  // operand, otherwise the left operand is popped
+  emit_op(op, -1);
+  emit_operand(node_index);
+  int done = emit_target();
+
+  compile_node(node->get_kid(1));
+  emit_op(OP_TRUTH, 0);
+  emit_operand(node_index);
+
+  patch_target(done);
+}
+
+void Compiler::compile_if(Node *node) {
+  emit_op(OP_ENTER_SCOPE, 0);
+  emit_operand(node->get_num_slots());
+  emit_operand(node->frame_escapes());
+  m_scope_depth++;
+
+  Node *condition = node->get_kid(0);
+  if (condition->get_tag() == AST_INT_LITERAL && condition->get_literal().get_ival() != 0) {
+    // no test needed (the optimizer leaves this form when only one
+    // arm can ever be executed)
+    compile_node(node->get_kid(1));
+    emit_op(OP_POP, -1);
+  } else {
+    compile_if_arms(node);
+  }
+
+  m_scope_depth--;
+  emit_op(OP_LEAVE_SCOPE, 0);
+  emit_op(OP_INT, 1);
+  emit_operand(0);
+}
+
+void Compiler::compile_if_arms(Node *node) {
+  Node *condition = node->get_kid(0);
+  compile_node(condition);
+  emit_op(OP_JUMP_IF_FALSE, -1);
+  emit_operand(m_chunk->add_node(condition));
+  int else_target = emit_target();
+
+  compile_node(node->get_kid(1));
+  emit_op(OP_POP, -1);
+
+  if (node->get_num_kids() == 3) {
+    emit_op(OP_JUMP, 0);
+    int end_target = emit_target();
+    patch_target(else_target);
+    compile_node(node->get_kid(2));
+    emit_op(OP_POP, -1);
+    patch_target(end_target);
+  } else {
+    patch_target(else_target);
+  }
+}
+
+void Compiler::compile_while(Node *node) {
+  emit_op(OP_ENTER_SCOPE, 0);
+  emit_operand(node->get_num_slots());
+  emit_operand(node->frame_escapes());
+  m_scope_depth++;
+
+  int top = int(m_chunk->get_code_size());
+  Node *condition = node->get_kid(0);
+  compile_node(condition);
+  emit_op(OP_JUMP_IF_FALSE, -1);
+  emit_operand(m_chunk->add_node(condition));
+  int end_target = emit_target();
+
+  compile_node(node->get_kid(1));
+  emit_op(OP_POP, -1);
+  emit_op(OP_JUMP, 0);
+  emit_operand(top);
+
+  patch_target(end_target);
+  m_scope_depth--;
+  emit_op(OP_LEAVE_SCOPE, 0);
+  emit_op(OP_INT, 1);
+  emit_operand(0);
+}
+
+void Compiler::compile_call(Node *node) {
+  const Intrinsic *intrinsic = node->get_intrinsic();
+  if (intrinsic != nullptr) {
+    // bound during analysis, so the function value isn't needed
+    Node *arglist = node->get_kid(1);
+    for (auto i = arglist->cbegin(); i != arglist->cend(); ++i) {
+      compile_node(*i);
+    }
+    static const Opcode s_call_ops[] = { OP_CALL_INTRINSIC1, OP_CALL_INTRINSIC2, OP_CALL_INTRINSIC3 };
+    emit_op(s_call_ops[intrinsic->arity - 1], 1 - intrinsic->arity);
+    emit_operand(m_chunk->add_node(node));
+    return;
+  }
+
+  // the function value goes below the arguments
+  compile_load(node->get_kid(0));
+
+  int num_args = 0;
+  if (node->get_num_kids() == 2) {
+    Node *arglist = node->get_kid(1);
+    for (auto i = arglist->cbegin(); i != arglist->cend(); ++i) {
+      compile_node(*i);
+      num_args++;
+    }
+  }
+
+  if (node->is_tail_call()) {
+    emit_op(OP_TAIL_CALL, -num_args);
+    emit_operand(num_args);
+    emit_operand(m_chunk->add_node(node));
+    emit_operand(m_scope_depth - m_body_scope_depth);
+    return;
+  }
+
+  emit_op(OP_CALL, -num_args);
+  emit_operand(num_args);
+  emit_operand(m_chunk->add_node(node));
+}
+
+void Compiler::compile_load(Node *varref) {
+  int depth = varref->get_depth();
+  if (depth == m_scope_depth) {
+    emit_op(OP_LOAD_GLOBAL, 1);
+  } else if (depth == 0) {
+    emit_op(OP_LOAD_LOCAL, 1);
+  } else {
+    emit_op(OP_LOAD, 1);
+    emit_operand(depth);
+  }
+  emit_operand(varref->get_slot());
+}
+
+void Compiler::compile_store(Node *varref) {
+  int depth = varref->get_depth();
+  if (depth == m_scope_depth) {
+    emit_op(OP_STORE_GLOBAL, 0);
+  } else if (depth == 0) {
+    emit_op(OP_STORE_LOCAL, 0);
+  } else {
+    emit_op(OP_STORE, 0);
+    emit_operand(depth);
+  }
+  emit_operand(varref->get_slot());
+}
+
+int Compiler::emit_op(Opcode op, int stack_effect) {
+  int offset = m_chunk->emit(op);
+  m_cur_stack += stack_effect;
+  assert(m_cur_stack >= 0);
+  if (m_cur_stack > m_chunk->get_max_stack()) {
+    m_chunk->set_max_stack(m_cur_stack);
+  }
+  return offset;
+}
@@ -0,0 +1,55 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "bytecode.h"
+class Node;
+
+// The Compiler lowers an analyzed AST to bytecode.
+// Each function body is compiled to its own Chunk.
+class Compiler {
+private:
+  Program *m_program;
+  Chunk *m_chunk;
+  int m_cur_stack;
+  // number of scopes between the code being compiled and the
+  // global scope (used to recognize references to globals)
+  int m_scope_depth;
+  // scope depth of the body of the function being compiled
+  int m_body_scope_depth;
+
+  // value semantics prohibited
+  Compiler(const Compiler &);
+  Compiler &operator=(const Compiler &);
+
+public:
+  Compiler(Program *program);
+  ~Compiler();
+
+  // Compile the top-level unit (which becomes chunk 0)
+  void compile_unit(Node *unit);
+  // Compile a function defined at the top level of a unit (which
+  // needn't be the one compiled by compile_unit()), returning the
+  // index of its Chunk
+  int compile_function(Node *func);
+
+private:
+  void compile_node(Node *node);
+  void compile_sequence(Node *node);
+  void compile_binary(Node *node, Opcode op);
+  void compile_logical(Node *node, Opcode op);
+  void compile_if(Node *node);
+  void compile_if_arms(Node *node);
+  void compile_while(Node *node);
+  void compile_call(Node *node);
+  void compile_load(Node *varref);
+  void compile_store(Node *varref);
+
+  // emit an instruction, adjusting the tracked stack depth by stack_effect
+  int emit_op(Opcode op, int stack_effect);
+  void emit_operand(int word) { m_chunk->emit(word); }
+  // emit a placeholder jump target operand, returning its offset
+  int emit_target() { return m_chunk->emit(-1); }
+  void patch_target(int offset) { m_chunk->patch(offset, int(m_chunk->get_code_size())); }
+};
+
+#endif // COMPILER_H
@@ -1,64 +1,49 @@
+#include <new>
+#include "frame_arena.h"
 #include "environment.h"
-#include "exceptions.h"
 #include "value.h"
-#include <csignal>
-#include <memory>
 
-Environment::Environment(Environment *parent)
+Environment::Environment(Environment *parent, Value *slots, unsigned num_slots, FrameArena *arena)
   : m_parent(parent)
-  , m_vars() {
+  , m_slots(slots)
+  , m_num_slots(num_slots)
+  , m_arena(arena) {
   assert(m_parent != this);
 }
 
 Environment::~Environment() {
 }
 
-int Environment::define_variable(std::string name) {
-  int check = m_vars.count(name);
-
-  if (check) {
-    return 1;
+Environment *Environment::create(Environment *parent, unsigned num_slots, FrameArena *arena) {
+  // a heap environment can outlive the code that created it,
+  // so its parent must be able to as well
+  assert(arena != nullptr || parent == nullptr || !parent->is_arena_allocated());
+
+  // the slots are stored directly after the Environment object
+  size_t size = sizeof(Environment) + num_slots * sizeof(Value);
+  void *mem = arena != nullptr ? arena->allocate(size) : ::operator new(size);
+  Value *slots = reinterpret_cast<Value *>(static_cast<char *>(mem) + sizeof(Environment));
+  for (unsigned i = 0; i < num_slots; i++) {
+    new (&slots[i]) Value();
   }
-
-
-  m_vars.emplace(name, Value(0));
-  return 0;
-}
-  
-Value* Environment::get_local_variable(std::string name) {
-  int check = m_vars.count(name);
-  if (!check) {
-    return nullptr;
+  Environment *env = new (mem) Environment(parent, slots, num_slots, arena);
+  if (arena == nullptr) {
+    Heap::get_current()->add(env, size);
   }
-  return &(m_vars.at(name));
+  return env;
 }
 
-int Environment::assign_variable(std::string name, Value& val) {
-
-  int check = m_vars.count(name);
-
-  if (!check && m_parent != nullptr) {
-    return m_parent->assign_variable(name, val);
-  } else if (!check) {
-    return 1;
+void Environment::release(Environment *env) {
+  FrameArena *arena = env->m_arena;
+  if (arena != nullptr) {
+    env->~Environment();
+    arena->deallocate(env);
   }
-  m_vars[name] = val;
-  return 0;
 }
 
-Value* Environment::get_variable(std::string name) {
-
-  Value* local_check = get_local_variable(name);
-
-  if (local_check == nullptr && m_parent != nullptr) {
-    return m_parent->get_variable(name);
-  } else {
-    return local_check;
+void Environment::trace(Heap &heap) const {
+  heap.mark(m_parent);
+  for (unsigned i = 0; i < m_num_slots; i++) {
+    heap.mark_value(m_slots[i]);
   }
 }
-
-void Environment::bind(std::string name, Value val) {
-  m_vars[name] = val;
-}
-
-// implement member functions
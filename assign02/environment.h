@@ -2,36 +2,69 @@
 #define ENVIRONMENT_H
 
 #include <cassert>
-#include <map>
-#include <string>
+#include "gc.h"
 #include "value.h"
+class FrameArena;
 
-class Environment {
+// Runtime environment for one scope. Variables are resolved to a
+// (depth, slot) lexical address during analysis (see Scope), so the
+// environment is just a flat array of Values plus a parent link.
+//
+// Environments for scopes that can never be captured by a Function
+// are allocated from a FrameArena, and freed (by release()) when the
+// scope is exited. Everything else (e.g., the global environment) is
+// allocated in the current Heap, and garbage collected: while a scope
+// is active, the interpreter keeps its Environment reachable.
+class Environment : public GCObject {
 private:
   Environment *m_parent;
-  // representation of environment (map of names to values)
-  std::map<std::string, Value> m_vars;
+  Value *m_slots;
+  unsigned m_num_slots;
+  FrameArena *m_arena;
+
+  Environment(Environment *parent, Value *slots, unsigned num_slots, FrameArena *arena);
 
   // copy constructor and assignment operator prohibited
   Environment(const Environment &);
   Environment &operator=(const Environment &);
 
 public:
-  Environment(Environment *parent = nullptr);
-  ~Environment();
+  virtual ~Environment();
+
+  // the slots are allocated along with the object (see create())
+  static void operator delete(void *p) { ::operator delete(p); }
+
+  // Create an Environment with num_slots variables (all 0).
+  // If arena is null the Environment is allocated in the current Heap.
+  static Environment *create(Environment *parent, unsigned num_slots, FrameArena *arena = nullptr);
+
+  // Called when the scope of an Environment is exited: an arena
+  // Environment is freed (heap Environments are left to the
+  // garbage collector, since Functions may still refer to them)
+  static void release(Environment *env);
 
-  // add member functions allowing lookup, definition, and assignment
+  virtual void trace(Heap &heap) const;
+  virtual size_t get_size() const { return sizeof(Environment) + m_num_slots * sizeof(Value); }
 
-  int define_variable(std::string name);
-  
-  Value* get_variable(std::string name);
+  bool is_arena_allocated() const { return m_arena != nullptr; }
 
-  int assign_variable(std::string name, Value& val);
+  Environment *get_parent() const { return m_parent; }
+  unsigned get_num_slots() const { return m_num_slots; }
 
-  Value* get_local_variable(std::string name);
+  Value &get_slot(unsigned slot) {
+    assert(slot < m_num_slots);
+    return m_slots[slot];
+  }
 
-  void bind(std::string name, Value val);
-  
+  // Find the variable at the given lexical address
+  Value &lookup(int depth, int slot) {
+    Environment *env = this;
+    while (depth > 0) {
+      env = env->m_parent;
+      depth--;
+    }
+    return env->get_slot(unsigned(slot));
+  }
 };
 
 #endif // ENVIRONMENT_H
@@ -0,0 +1,108 @@
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include "input_buffer.h"
+#include "string.h"
+#include "file.h"
+
+namespace {
+
+// how much of the file is read between dropping the part already
+// read from memory (so a big file can be read a line at a time
+// without all of it ending up in memory)
+const unsigned DISCARD_CHUNK = 16 << 20;
+
+}
+
+File::File(const std::string &filename, String *contents, InputBuffer *input)
+  : ValRep(VALREP_FILE, sizeof(File))
+  , m_filename(filename)
+  , m_contents(contents)
+  , m_input(input)
+  , m_pos(0)
+  , m_discarded(0) {
+}
+
+File::~File() {
+}
+
+File *File::open(const std::string &filename) {
+  FILE *in = fopen(filename.c_str(), "rb");
+  if (in == nullptr) {
+    return nullptr;
+  }
+
+  InputBuffer *input;
+  try {
+    input = new InputBuffer(in, filename);
+  } catch (...) {
+    fclose(in);
+    throw;
+  }
+  // a mapping stays valid after the file is closed
+  fclose(in);
+
+  if (input->size() >= UINT_MAX) {
+    delete input;
+    return nullptr;
+  }
+  return new File(filename, new String(input), input);
+}
+
+// The file's buffer is shared, so the copy is a view of the same
+// mapping
+File *File::copy() const {
+  File *file = new File(m_filename, m_contents->copy(), m_input);
+  file->m_pos = m_pos;
+  file->m_discarded = m_discarded;
+  return file;
+}
+
+// the buffer (and so the InputBuffer) lives as long as m_contents
+void File::trace(Heap &heap) const {
+  heap.mark(m_contents);
+}
+
+String *File::read_line() {
+  unsigned len = unsigned(m_contents->len());
+  if (m_pos == len) {
+    return new String("");
+  }
+  const char *start = m_contents->data() + m_pos;
+  const char *newline = static_cast<const char *>(memchr(start, '\n', len - m_pos));
+  unsigned line_len = newline != nullptr ? unsigned(newline - start) + 1 : len - m_pos;
+  String *line = m_contents->view(m_pos, line_len);
+  advance(m_pos + line_len);
+  return line;
+}
+
+String *File::read_all() {
+  unsigned len = unsigned(m_contents->len());
+  String *rest = m_contents->view(m_pos, len - m_pos);
+  m_pos = len;
+  return rest;
+}
+
+std::vector<Value> File::read_lines() {
+  std::vector<Value> lines;
+  unsigned len = unsigned(m_contents->len());
+  const char *data = m_contents->data();
+  while (m_pos < len) {
+    const char *start = data + m_pos;
+    const char *newline = static_cast<const char *>(memchr(start, '\n', len - m_pos));
+    unsigned line_len = newline != nullptr ? unsigned(newline - start) : len - m_pos;
+    lines.push_back(Value(m_contents->view(m_pos, line_len)));
+    m_pos += line_len + (newline != nullptr ? 1 : 0);
+  }
+  return lines;
+}
+
+// Move the read position forward to pos, dropping the part of the
+// file behind it from memory now and then. Views of the dropped
+// part still work (the pages are read from the file again).
+void File::advance(unsigned pos) {
+  m_pos = pos;
+  if (m_pos - m_discarded >= DISCARD_CHUNK) {
+    m_discarded = unsigned(m_input->discard(m_discarded, m_pos));
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <string>
+#include <vector>
+#include "valrep.h"
+#include "value.h"
+class String;
+class InputBuffer;
+
+// A File is an input file opened by the openfile intrinsic, read
+// from start to end. The whole file is mapped in to memory (see
+// InputBuffer) as the buffer of one String, so the Strings that are
+// read from it are views of the mapping rather than copies.
+class File : public ValRep {
+private:
+  std::string m_filename;
+  // all of the file, and its buffer
+  String *m_contents;
+  InputBuffer *m_input;
+  // where the next read starts, and the end of the part of the file
+  // the system has been told it can drop from memory (see advance())
+  unsigned m_pos, m_discarded;
+
+  File(const std::string &filename, String *contents, InputBuffer *input);
+
+  // value semantics prohibited
+  File(const File &);
+  File &operator=(const File &);
+
+public:
+  virtual ~File();
+
+  // Returns null if the file can't be opened, or is too big to
+  // be a String (4GB or more)
+  static File *open(const std::string &filename);
+
+  // A File reading the same file from the same position (which
+  // can be used on another thread)
+  File *copy() const;
+
+  virtual void trace(Heap &heap) const;
+  virtual size_t get_size() const { return sizeof(File); }
+
+  // The next line, including its newline (so the result is empty
+  // only at the end of the file)
+  String *read_line();
+  // The rest of the file
+  String *read_all();
+  // The remaining lines, without their newlines
+  std::vector<Value> read_lines();
+
+  std::string as_str() const { return "<file " + m_filename + ">"; }
+
+private:
+  void advance(unsigned pos);
+};
+
+#endif // FILE_H
@@ -0,0 +1,69 @@
+#include <cassert>
+#include <new>
+#include "frame_arena.h"
+
+namespace {
+
+const size_t BLOCK_SIZE = 64 * 1024;
+const size_t ALIGN = 16;
+
+}
+
+FrameArena::FrameArena()
+  : m_cur(0) {
+}
+
+FrameArena::~FrameArena() {
+  for (auto i = m_blocks.begin(); i != m_blocks.end(); ++i) {
+    ::operator delete(i->base);
+  }
+}
+
+void *FrameArena::allocate(size_t size) {
+  size = (size + ALIGN - 1) & ~(ALIGN - 1);
+
+  // find a block with enough room, moving on to the next
+  // block (and creating it, if necessary) when the current
+  // one is full
+  while (m_cur < m_blocks.size() && m_blocks[m_cur].used + size > m_blocks[m_cur].size) {
+    if (m_blocks[m_cur].used == 0) {
+      // an empty block that is too small for this frame is replaced
+      ::operator delete(m_blocks[m_cur].base);
+      m_blocks.erase(m_blocks.begin() + m_cur);
+    } else {
+      m_cur++;
+    }
+  }
+  if (m_cur == m_blocks.size()) {
+    Block block;
+    block.size = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+    block.base = static_cast<char *>(::operator new(block.size));
+    block.used = 0;
+    m_blocks.push_back(block);
+  }
+
+  Block &block = m_blocks[m_cur];
+  void *p = block.base + block.used;
+  block.used += size;
+  return p;
+}
+
+void FrameArena::deallocate(void *p) {
+  char *addr = static_cast<char *>(p);
+
+  // blocks above the one containing p are no longer in use
+  while (addr < m_blocks[m_cur].base || addr >= m_blocks[m_cur].base + m_blocks[m_cur].size) {
+    assert(m_cur > 0);
+    m_blocks[m_cur].used = 0;
+    m_cur--;
+  }
+  m_blocks[m_cur].used = size_t(addr - m_blocks[m_cur].base);
+}
+
+size_t FrameArena::get_capacity() const {
+  size_t total = 0;
+  for (auto i = m_blocks.begin(); i != m_blocks.end(); ++i) {
+    total += i->size;
+  }
+  return total;
+}
@@ -0,0 +1,43 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// A FrameArena provides the memory for Environments that escape
+// analysis has shown can never be captured by a Function. Those
+// environments are created and destroyed in strict LIFO order, so
+// allocation is a pointer bump and freeing resets the pointer.
+// Memory is kept in a list of blocks which are reused once freed,
+// so deep recursion does not grow the heap once the deepest call
+// has been reached.
+class FrameArena {
+private:
+  struct Block {
+    char *base;
+    size_t size;
+    size_t used;
+  };
+
+  std::vector<Block> m_blocks;
+  unsigned m_cur;
+
+  // value semantics prohibited
+  FrameArena(const FrameArena &);
+  FrameArena &operator=(const FrameArena &);
+
+public:
+  FrameArena();
+  ~FrameArena();
+
+  void *allocate(size_t size);
+
+  // Free the memory at p, which must be the most recent
+  // allocation that hasn't been freed yet
+  void deallocate(void *p);
+
+  // total number of bytes reserved for frames
+  size_t get_capacity() const;
+};
+
+#endif // FRAME_ARENA_H
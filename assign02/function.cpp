@@ -1,14 +1,20 @@
+#include "environment.h"
 #include "function.h"
 
 Function::Function(const std::string &name, const std::vector<std::string> &params, Environment *parent_env, Node *body)
-  : ValRep(VALREP_FUNCTION)
+  : ValRep(VALREP_FUNCTION, sizeof(Function))
   , m_name(name)
   , m_params(params)
   , m_parent_env(parent_env)
-  , m_body(body) {
+  , m_body(body)
+  , m_chunk(nullptr) {
 }
 
 Function::~Function() {
 }
 
+void Function::trace(Heap &heap) const {
+  heap.mark(m_parent_env);
+}
+
 // TODO: implement member functions
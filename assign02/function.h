@@ -6,6 +6,7 @@
 #include "valrep.h"
 class Environment;
 class Node;
+class Chunk;
 
 class Function : public ValRep {
 private:
@@ -13,6 +14,7 @@ private:
   std::vector<std::string> m_params;
   Environment *m_parent_env;
   Node *m_body;
+  Chunk *m_chunk;
 
   // value semantics prohibited
   Function(const Function &);
@@ -22,11 +24,18 @@ public:
   Function(const std::string &name, const std::vector<std::string> &params, Environment *parent_env, Node *body);
   virtual ~Function();
 
+  virtual void trace(Heap &heap) const;
+  virtual size_t get_size() const { return sizeof(Function); }
+
   std::string get_name() const { return m_name; }
   const std::vector<std::string> &get_params() const { return m_params; }
   unsigned get_num_params() const { return unsigned(m_params.size()); }
   Environment *get_parent_env() const { return m_parent_env; }
   Node *get_body() const { return m_body; }
+
+  // compiled code for the body (only set when running on the VM)
+  Chunk *get_chunk() const { return m_chunk; }
+  void set_chunk(Chunk *chunk) { m_chunk = chunk; }
 };
 
 #endif // FUNCTION_H
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <chrono>
+#include "value.h"
+#include "gc.h"
+
+namespace {
+
+// allocate at least this much between collections
+const size_t MIN_THRESHOLD = 1 << 20;
+
+thread_local Heap *t_current_heap = nullptr;
+
+uint64_t now_ns() {
+  return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+}
+
+GCObject::~GCObject() {
+}
+
+Heap::Heap()
+  : m_objects(nullptr)
+  , m_num_objects(0)
+  , m_allocated(0)
+  , m_threshold(MIN_THRESHOLD)
+  , m_live_bytes(0)
+  , m_epoch(1)
+  , m_stats() {
+}
+
+Heap::~Heap() {
+  GCObject *obj = m_objects;
+  while (obj != nullptr) {
+    GCObject *next = obj->m_gc_next;
+    delete obj;
+    obj = next;
+  }
+}
+
+void Heap::add(GCObject *obj, size_t size) {
+  obj->m_gc_next = m_objects;
+  m_objects = obj;
+  m_num_objects++;
+  m_allocated += size;
+}
+
+void Heap::mark_value(const Value &val) {
+  if (val.is_dynamic()) {
+    mark(val.get_rep());
+  }
+}
+
+void Heap::print_stats(FILE *out) const {
+  fprintf(out, "gc: %lu collections, %lu objects freed, pauses %.3f ms total, %.3f ms max\n",
+          m_stats.num_collections, m_stats.num_freed,
+          m_stats.total_pause_ns / 1e6, m_stats.max_pause_ns / 1e6);
+  fprintf(out, "gc: heap %.1f KB after the last collection (peak %.1f KB), %lu objects\n",
+          m_stats.heap_size / 1024.0, m_stats.peak_heap_size / 1024.0, m_num_objects);
+}
+
+Heap *Heap::get_current() {
+  thread_local Heap t_default_heap;
+  return t_current_heap != nullptr ? t_current_heap : &t_default_heap;
+}
+
+Heap::Activation::Activation(Heap *heap)
+  : m_saved(t_current_heap) {
+  t_current_heap = heap;
+}
+
+Heap::Activation::~Activation() {
+  t_current_heap = m_saved;
+}
+
+uint64_t Heap::begin_collection() {
+  m_epoch++;
+  m_live_bytes = 0;
+  return now_ns();
+}
+
+void Heap::finish_collection(uint64_t start) {
+  // trace everything reachable from the roots
+  while (!m_mark_stack.empty()) {
+    const GCObject *obj = m_mark_stack.back();
+    m_mark_stack.pop_back();
+    obj->trace(*this);
+  }
+
+  sweep();
+
+  // collect again once as much has been allocated as survived
+  // this collection (so the heap is at most about twice the
+  // size of the live data)
+  m_allocated = 0;
+  m_threshold = std::max(MIN_THRESHOLD, m_live_bytes);
+
+  uint64_t pause = now_ns() - start;
+  m_stats.num_collections++;
+  m_stats.total_pause_ns += pause;
+  m_stats.max_pause_ns = std::max(m_stats.max_pause_ns, pause);
+  m_stats.heap_size = m_live_bytes;
+  m_stats.peak_heap_size = std::max(m_stats.peak_heap_size, m_live_bytes);
+}
+
+// Free every object that wasn't marked in this collection
+void Heap::sweep() {
+  GCObject **link = &m_objects;
+  while (*link != nullptr) {
+    GCObject *obj = *link;
+    if (obj->m_gc_epoch == m_epoch || obj->m_gc_epoch == PINNED) {
+      m_live_bytes += obj->get_size();
+      link = &obj->m_gc_next;
+    } else {
+      *link = obj->m_gc_next;
+      delete obj;
+      m_num_objects--;
+      m_stats.num_freed++;
+    }
+  }
+}
@@ -0,0 +1,148 @@
+#ifndef GC_H
+#define GC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+class Heap;
+class Value;
+
+// Base class of the objects managed by the garbage collector:
+// Functions, Strings, Arrays (via ValRep) and Environments.
+class GCObject {
+private:
+  GCObject *m_gc_next;
+  // the number of the last collection that found the object reachable
+  unsigned m_gc_epoch;
+
+  friend class Heap;
+
+  // value semantics prohibited
+  GCObject(const GCObject &);
+  GCObject &operator=(const GCObject &);
+
+public:
+  GCObject() : m_gc_next(nullptr), m_gc_epoch(0) { }
+  virtual ~GCObject();
+
+  // Mark the objects this object refers to
+  virtual void trace(Heap &heap) const = 0;
+
+  // Number of bytes used by the object itself (memory it shares
+  // with other objects is reported by trace(), see Heap::claim())
+  virtual size_t get_size() const = 0;
+};
+
+// A Heap owns every GCObject allocated while it is the current heap,
+// and frees the ones that can no longer be reached by a mark-sweep
+// collection. Collections only happen when the interpreter asks for
+// one (at points where it knows all of its roots), so objects held
+// by C++ code in between are never freed out from under it.
+//
+// Reaching objects that aren't in the Heap (such as Environments
+// allocated from a FrameArena) is fine: they are traced, but never
+// freed. Marking uses an epoch number rather than a mark bit, so
+// there are no mark bits to clear afterwards.
+class Heap {
+public:
+  struct Stats {
+    unsigned long num_collections;
+    unsigned long num_freed;
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+    size_t heap_size;       // bytes in use after the last collection
+    size_t peak_heap_size;
+  };
+
+private:
+  GCObject *m_objects;
+  unsigned long m_num_objects;
+  // bytes allocated since the last collection, and how many
+  // bytes can be allocated before the next one
+  size_t m_allocated;
+  size_t m_threshold;
+  size_t m_live_bytes;
+  unsigned m_epoch;
+  std::vector<const GCObject *> m_mark_stack;
+  Stats m_stats;
+
+  // the "epoch" of pinned objects
+  static const unsigned PINNED = ~0u;
+
+  // value semantics prohibited
+  Heap(const Heap &);
+  Heap &operator=(const Heap &);
+
+public:
+  Heap();
+  // frees all of the objects in the heap
+  ~Heap();
+
+  // Take ownership of a newly created object of about size bytes
+  void add(GCObject *obj, size_t size);
+
+  bool should_collect() const { return m_allocated >= m_threshold; }
+
+  // Free the unreachable objects: mark_roots(Heap &) must mark
+  // every object the caller can still use
+  template<typename Fn>
+  void collect(Fn mark_roots) {
+    uint64_t start = begin_collection();
+    mark_roots(*this);
+    finish_collection(start);
+  }
+
+  void mark(const GCObject *obj) {
+    if (obj != nullptr && obj->m_gc_epoch != m_epoch && obj->m_gc_epoch != PINNED) {
+      const_cast<GCObject *>(obj)->m_gc_epoch = m_epoch;
+      m_mark_stack.push_back(obj);
+    }
+  }
+  void mark_value(const Value &val);
+
+  // For memory shared by several objects (such as a String's buffer):
+  // returns true, and counts num_bytes as live, only the first time
+  // it is called for epoch during a collection
+  bool claim(unsigned &epoch, size_t num_bytes) {
+    if (epoch == m_epoch) {
+      return false;
+    }
+    epoch = m_epoch;
+    m_live_bytes += num_bytes;
+    return true;
+  }
+
+  // Keep an object (which must not refer to any other objects)
+  // until the heap is destroyed. A pinned object is never marked, so
+  // other threads' heaps can refer to it too.
+  void pin(GCObject *obj) { obj->m_gc_epoch = PINNED; }
+  static bool is_pinned(const GCObject *obj) { return obj->m_gc_epoch == PINNED; }
+
+  unsigned long get_num_objects() const { return m_num_objects; }
+  // roughly how many bytes the objects in the heap use
+  size_t get_num_bytes() const { return m_live_bytes + m_allocated; }
+  const Stats &get_stats() const { return m_stats; }
+  void print_stats(FILE *out) const;
+
+  // The heap that new objects are added to on this thread: the one
+  // most recently activated (see Activation), or else a default
+  // heap that lives as long as the thread
+  static Heap *get_current();
+
+  // Makes a heap the current heap while it is in scope
+  class Activation {
+  private:
+    Heap *m_saved;
+  public:
+    Activation(Heap *heap);
+    ~Activation();
+  };
+
+private:
+  uint64_t begin_collection();
+  void finish_collection(uint64_t start);
+  void sweep();
+};
+
+#endif // GC_H
@@ -0,0 +1,54 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "exceptions.h"
+#include "input_buffer.h"
+
+InputBuffer::InputBuffer(FILE *in, const std::string &filename)
+  : m_data(nullptr)
+  , m_size(0)
+  , m_map(nullptr) {
+  struct stat st;
+  int fd = fileno(in);
+  // an empty file can't be mapped, but there's nothing to read anyway
+  if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && ftell(in) == 0) {
+    void *map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, size_t(st.st_size), MADV_SEQUENTIAL);
+      m_map = map;
+      m_data = static_cast<const char *>(map);
+      m_size = size_t(st.st_size);
+      return;
+    }
+  }
+
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    m_contents.append(buf, n);
+  }
+  if (ferror(in)) {
+    RuntimeError::raise("Error reading input file '%s'", filename.c_str());
+  }
+  m_data = m_contents.data();
+  m_size = m_contents.size();
+}
+
+InputBuffer::~InputBuffer() {
+  if (m_map != nullptr) {
+    munmap(m_map, m_size);
+  }
+}
+
+size_t InputBuffer::discard(size_t begin, size_t end) const {
+  if (m_map == nullptr) {
+    return end;
+  }
+  size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+  begin = (begin + page_size - 1) / page_size * page_size;
+  end = end / page_size * page_size;
+  if (begin < end) {
+    madvise(static_cast<char *>(m_map) + begin, end - begin, MADV_DONTNEED);
+  }
+  return end;
+}
@@ -0,0 +1,39 @@
+#ifndef INPUT_BUFFER_H
+#define INPUT_BUFFER_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+// An InputBuffer holds the entire contents of an input file in
+// memory. Regular files are mapped (so nothing is copied); other
+// inputs (such as pipes or a terminal) are read in to a string.
+class InputBuffer {
+private:
+  const char *m_data;
+  size_t m_size;
+  void *m_map;
+  std::string m_contents;
+
+  // value semantics prohibited
+  InputBuffer(const InputBuffer &);
+  InputBuffer &operator=(const InputBuffer &);
+
+public:
+  // Read all of in. Throws RuntimeError if the input can't be read.
+  InputBuffer(FILE *in, const std::string &filename);
+  ~InputBuffer();
+
+  const char *begin() const { return m_data; }
+  const char *end() const { return m_data + m_size; }
+  size_t size() const { return m_size; }
+  bool is_mapped() const { return m_map != nullptr; }
+
+  // Let the system reclaim the memory holding bytes [begin, end)
+  // of a mapped file (they are read from the file again if they are
+  // used later). Only whole pages are dropped, so the result is where
+  // the next call should begin.
+  size_t discard(size_t begin, size_t end) const;
+};
+
+#endif // INPUT_BUFFER_H
@@ -0,0 +1,62 @@
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
+#include "int_reader.h"
+
+IntReader::IntReader(int fd)
+  : m_fd(fd)
+  , m_buf(nullptr)
+  , m_pos(0)
+  , m_len(0)
+  , m_eof(false) {
+}
+
+IntReader::~IntReader() {
+  delete[] m_buf;
+}
+
+int IntReader::read_int() {
+  int c = peek();
+  while (c != -1 && isspace(c)) {
+    m_pos++;
+    c = peek();
+  }
+
+  bool negative = false;
+  if (c == '-' || c == '+') {
+    negative = c == '-';
+    m_pos++;
+    c = peek();
+  }
+
+  // accumulate unsigned, so that out of range numbers wrap
+  unsigned magnitude = 0;
+  while (c >= '0' && c <= '9') {
+    magnitude = magnitude * 10 + unsigned(c - '0');
+    m_pos++;
+    c = peek();
+  }
+  return int(negative ? 0u - magnitude : magnitude);
+}
+
+// Read the next block of input, returning false at the end
+bool IntReader::fill() {
+  if (m_eof) {
+    return false;
+  }
+  // (allocated when first needed, since most programs don't read)
+  if (m_buf == nullptr) {
+    m_buf = new char[CAPACITY];
+  }
+  ssize_t n;
+  do {
+    n = read(m_fd, m_buf, CAPACITY);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    m_eof = true;
+    return false;
+  }
+  m_pos = 0;
+  m_len = size_t(n);
+  return true;
+}
@@ -0,0 +1,48 @@
+#ifndef INT_READER_H
+#define INT_READER_H
+
+#include <cstddef>
+
+// An IntReader reads whitespace-separated integers from a file
+// descriptor (for the readint intrinsic), in large blocks rather
+// than a character or a number at a time. It follows scanf("%d"):
+// leading whitespace is skipped, and if there is no number at the
+// current position (or at the end of the input) the result is 0.
+class IntReader {
+private:
+  static const size_t CAPACITY = 64 * 1024;
+
+  int m_fd;
+  char *m_buf;
+  size_t m_pos, m_len;
+  bool m_eof;
+
+  // value semantics prohibited
+  IntReader(const IntReader &);
+  IntReader &operator=(const IntReader &);
+
+public:
+  IntReader(int fd);
+  ~IntReader();
+
+  // True if reading the next int may have to wait for input
+  bool needs_input() const { return m_pos == m_len && !m_eof; }
+
+  int read_int();
+
+  // Act as though the end of the input has been reached
+  void close() { m_eof = true; }
+
+private:
+  // the next character (without consuming it), or -1 at the end
+  // of the input
+  int peek() {
+    if (m_pos == m_len && !fill()) {
+      return -1;
+    }
+    return static_cast<unsigned char>(m_buf[m_pos]);
+  }
+  bool fill();
+};
+
+#endif // INT_READER_H
@@ -1,134 +1,581 @@
 #include <cassert>
 #include <algorithm>
-#include <memory>
+#include <iterator>
+#include <optional>
 #include <unistd.h>
 #include "array.h"
 #include "ast.h"
 #include "environment.h"
+#include "frame_arena.h"
+#include "scope.h"
 #include "node.h"
 #include "exceptions.h"
 #include "function.h"
+#include "map.h"
+#include "file.h"
+#include "task.h"
+#include "thread_pool.h"
+#include "value_copier.h"
 #include "value.h"
 #include "string.h"
+#include "bytecode.h"
+#include "compiler.h"
+#include "vm.h"
+#include "profiler.h"
+#include "optimizer.h"
+#include "snapshot.h"
 #include "interp.h"
 
+// Keeps a newly created Environment reachable (as a garbage
+// collection root) until the scope it belongs to is exited
+class Interpreter::ScopedEnvironment {
+private:
+  Interpreter *m_interp;
+  Environment *m_env;
+
+  // value semantics prohibited
+  ScopedEnvironment(const ScopedEnvironment &);
+  ScopedEnvironment &operator=(const ScopedEnvironment &);
+
+public:
+  ScopedEnvironment(Interpreter *interp, Environment *env)
+    : m_interp(interp)
+    , m_env(env) {
+    m_interp->m_env_roots.push_back(env);
+  }
+
+  ~ScopedEnvironment() {
+    m_interp->m_env_roots.pop_back();
+    Environment::release(m_env);
+  }
+
+  Environment *get() const { return m_env; }
+  Environment *operator->() const { return m_env; }
+};
+
+// Values pushed onto a TempRoots are garbage collection roots
+// until it goes out of scope. They are stored on the interpreter's
+// stack of temporary roots, so get() is only valid until something
+// else is pushed.
+class Interpreter::TempRoots {
+private:
+  Interpreter *m_interp;
+  size_t m_base;
+
+  // value semantics prohibited
+  TempRoots(const TempRoots &);
+  TempRoots &operator=(const TempRoots &);
+
+public:
+  TempRoots(Interpreter *interp)
+    : m_interp(interp)
+    , m_base(interp->m_temp_roots.size()) {
+  }
+
+  ~TempRoots() { m_interp->m_temp_roots.resize(m_base); }
+
+  void push(const Value &val) { m_interp->m_temp_roots.push_back(val); }
+  Value *get() const { return m_interp->m_temp_roots.data() + m_base; }
+};
+
 Interpreter::Interpreter(Node *ast_to_adopt)
-  : m_ast(ast_to_adopt) {
+  : m_parent(nullptr)
+  , m_ast(ast_to_adopt)
+  , m_snapshot(nullptr)
+  , m_prelude(nullptr)
+  , m_program(nullptr)
+  , m_mode(EXECUTE_BYTECODE)
+  , m_global_env(nullptr)
+  , m_global_refs(nullptr)
+  , m_tail_call_pending(false)
+  , m_profiler(nullptr)
+  , m_vm(nullptr)
+  , m_num_quickened(0)
+  , m_num_deoptimized(0)
+  , m_quicken(true)
+  , m_output(stdout)
+  , m_int_reader(0) {
+}
+
+// A task's interpreter shares its parent's AST and Program, and
+// keeps its output (for the parent to write when the task is joined)
+Interpreter::Interpreter(Interpreter *parent)
+  : m_parent(parent)
+  , m_ast(parent->m_ast)
+  , m_snapshot(nullptr)
+  , m_prelude(nullptr)
+  , m_program(parent->m_program)
+  , m_mode(parent->m_mode)
+  , m_global_env(nullptr)
+  , m_global_refs(nullptr)
+  , m_tail_call_pending(false)
+  , m_profiler(nullptr)
+  , m_vm(nullptr)
+  , m_num_quickened(0)
+  , m_num_deoptimized(0)
+  , m_quicken(false)
+  , m_int_reader(0) {
+}
+
+void Interpreter::start_from(const Snapshot *snapshot) {
+  assert(m_prelude == nullptr);
+  if (snapshot->get_num_intrinsics() != NUM_INTRINSICS) {
+    RuntimeError::raise("Snapshot file '%s' was saved by a different version of the interpreter",
+                        snapshot->get_filename().c_str());
+  }
+  m_snapshot = snapshot;
+  m_prelude = snapshot->load_prelude();
+}
+
+void Interpreter::save_snapshot(const std::string &filename, const std::string &prelude_filename,
+                                const std::string &parsed_ast) {
+  // (a prelude's functions must all be defined by its own AST)
+  assert(m_global_env != nullptr && m_prelude == nullptr);
+  Snapshot::write(filename, prelude_filename, parsed_ast, m_ast, m_global_env, s_intrinsics, NUM_INTRINSICS);
+}
+
+void Interpreter::isolate() {
+  m_output.keep();
+  m_int_reader.close();
 }
 
 Interpreter::~Interpreter() {
-  delete m_ast;
+  // tasks still running (if the program failed) use the AST
+  for (auto i = m_tasks.begin(); i != m_tasks.end(); ++i) {
+    (*i)->wait();
+  }
+  delete m_profiler;
+  if (m_parent == nullptr) {
+    delete m_program;
+    delete m_ast;
+    delete m_prelude;
+  }
+  // everything else is freed by the heap
 }
 
+// The intrinsic function registry, in the order of the intrinsics'
+// slots in the global environment. Each entry gives the kinds of
+// arguments the intrinsic requires, and the errors reported when it
+// is called with the wrong number or kinds of arguments.
+const Intrinsic Interpreter::s_intrinsics[] = {
+  Intrinsic("print", &intrinsic_print, PARAM_ANY,
+            "Wrong number of arguments passed to print function", nullptr),
+  Intrinsic("println", &intrinsic_println, PARAM_ANY,
+            "Wrong number of arguments passed to print function", nullptr),
+  Intrinsic("readint", &intrinsic_readint),
+
+  Intrinsic("get", &intrinsic_get, PARAM_ARRAY, PARAM_INT,
+            "Wrong number of arguments passed to get function",
+            "Wrong type of arguments passed to get function"),
+  Intrinsic("set", &intrinsic_set, PARAM_ARRAY, PARAM_INT, PARAM_ANY,
+            "Wrong number of arguments passed to set function",
+            "Wrong type of arguments passed to set function"),
+  Intrinsic("mkarr", &intrinsic_mkarr),
+  Intrinsic("len", &intrinsic_len, PARAM_ARRAY,
+            "Wrong number of arguments passed to len function",
+            "Wrong type of arguments passed to len function"),
+  Intrinsic("push", &intrinsic_push, PARAM_ARRAY, PARAM_ANY,
+            "Wrong number of arguments passed to push function",
+            "Wrong type of argument passed to push function"),
+  Intrinsic("pop", &intrinsic_pop, PARAM_ARRAY,
+            "Wrong number of arguments passed to pop function",
+            "Wrong type of argument passed to pop function"),
+
+  Intrinsic("strlen", &intrinsic_strlen, PARAM_STRING,
+            "Wrong number of arguments passed to len function",
+            "Wrong type of argument passed to len function"),
+  Intrinsic("strcat", &intrinsic_strcat, PARAM_STRING, PARAM_STRING,
+            "Wrong number of arguments passed to strcat function",
+            "Wrong type of argument passed to strcat function"),
+  Intrinsic("substr", &intrinsic_substr, PARAM_STRING, PARAM_INT, PARAM_INT,
+            "Wrong number of arguments passed to substr function",
+            "Wrong type of argument passed to substr function"),
+  // (the slots from here on can be taken by a global var, see
+  // NUM_RESERVED_INTRINSICS)
+
+  Intrinsic("sum", &intrinsic_sum, PARAM_ARRAY,
+            "Wrong number of arguments passed to sum function",
+            "Wrong type of argument passed to sum function"),
+  Intrinsic("fill", &intrinsic_fill, PARAM_ARRAY, PARAM_ANY,
+            "Wrong number of arguments passed to fill function",
+            "Wrong type of arguments passed to fill function"),
+  Intrinsic("range", &intrinsic_range, PARAM_INT, PARAM_INT,
+            "Wrong number of arguments passed to range function",
+            "Wrong type of arguments passed to range function"),
+  Intrinsic("indexof", &intrinsic_indexof, PARAM_ARRAY, PARAM_ANY,
+            "Wrong number of arguments passed to indexof function",
+            "Wrong type of arguments passed to indexof function"),
+  Intrinsic("sort", &intrinsic_sort, PARAM_ARRAY,
+            "Wrong number of arguments passed to sort function",
+            "Wrong type of argument passed to sort function"),
+  Intrinsic("reverse", &intrinsic_reverse, PARAM_ARRAY,
+            "Wrong number of arguments passed to reverse function",
+            "Wrong type of argument passed to reverse function"),
+  Intrinsic("slice", &intrinsic_slice, PARAM_ARRAY, PARAM_INT, PARAM_INT,
+            "Wrong number of arguments passed to slice function",
+            "Wrong type of arguments passed to slice function"),
+
+  Intrinsic("mkmap", &intrinsic_mkmap),
+  Intrinsic("mput", &intrinsic_mput, PARAM_MAP, PARAM_ANY, PARAM_ANY,
+            "Wrong number of arguments passed to mput function",
+            "Wrong type of arguments passed to mput function"),
+  Intrinsic("mget", &intrinsic_mget, PARAM_MAP, PARAM_ANY,
+            "Wrong number of arguments passed to mget function",
+            "Wrong type of arguments passed to mget function"),
+  Intrinsic("mhas", &intrinsic_mhas, PARAM_MAP, PARAM_ANY,
+            "Wrong number of arguments passed to mhas function",
+            "Wrong type of arguments passed to mhas function"),
+  Intrinsic("mdel", &intrinsic_mdel, PARAM_MAP, PARAM_ANY,
+            "Wrong number of arguments passed to mdel function",
+            "Wrong type of arguments passed to mdel function"),
+  Intrinsic("mkeys", &intrinsic_mkeys, PARAM_MAP,
+            "Wrong number of arguments passed to mkeys function",
+            "Wrong type of argument passed to mkeys function"),
+
+  Intrinsic("openfile", &intrinsic_openfile, PARAM_STRING,
+            "Wrong number of arguments passed to openfile function",
+            "Wrong type of argument passed to openfile function"),
+  Intrinsic("readline", &intrinsic_readline, PARAM_FILE,
+            "Wrong number of arguments passed to readline function",
+            "Wrong type of argument passed to readline function"),
+  Intrinsic("readall", &intrinsic_readall, PARAM_FILE,
+            "Wrong number of arguments passed to readall function",
+            "Wrong type of argument passed to readall function"),
+  Intrinsic("lines", &intrinsic_lines, PARAM_FILE,
+            "Wrong number of arguments passed to lines function",
+            "Wrong type of argument passed to lines function"),
+
+  Intrinsic("spawn", &intrinsic_spawn),
+  Intrinsic("join", &intrinsic_join, PARAM_TASK,
+            "Wrong number of arguments passed to join function",
+            "Wrong type of argument passed to join function"),
+};
+
+const unsigned Interpreter::NUM_INTRINSICS = sizeof(s_intrinsics) / sizeof(s_intrinsics[0]);
+const unsigned Interpreter::NUM_RESERVED_INTRINSICS = 12;
+
 void Interpreter::analyze() {
-  auto global_env = std::unique_ptr<Environment>(new Environment());
+  // interned strings belong to this interpreter's heap
+  Heap::Activation activation(&m_heap);
+  Scope global_scope;
+  for (unsigned i = 0; i < NUM_INTRINSICS; i++) {
+    global_scope.define_variable(s_intrinsics[i].name);
+  }
+  m_intrinsic_calls.clear();
+  m_intrinsic_rebound.assign(NUM_INTRINSICS, false);
+  m_intrinsic_shadowed.assign(NUM_INTRINSICS, false);
+
+  // a program started from a snapshot is analyzed as though it
+  // followed the prelude
+  if (m_prelude != nullptr) {
+    analyze_recurse(m_prelude, &global_scope);
+  }
+  analyze_recurse(m_ast, &global_scope);
+  bind_intrinsic_calls();
+  m_ast->set_num_slots(global_scope.get_num_slots());
+  // the global environment is always allocated on the heap
+  m_ast->set_frame_escapes(true);
+}
 
-  global_env->bind("print", Value(&intrinsic_print));
-  global_env->bind("println", Value(&intrinsic_println));
-  global_env->bind("readint", Value(&intrinsic_readint));
+unsigned Interpreter::optimize() {
+  assert(m_program == nullptr);
+  Optimizer optimizer;
+  if (m_prelude != nullptr) {
+    optimizer.optimize_unit(m_prelude);
+  }
+  optimizer.optimize_unit(m_ast);
+  return optimizer.get_num_removed();
+}
 
-  global_env->bind("get", Value(&intrinsic_get));
-  global_env->bind("set", Value(&intrinsic_set));
-  global_env->bind("mkarr", Value(&intrinsic_mkarr));
-  global_env->bind("len", Value(&intrinsic_len));
-  global_env->bind("push", Value(&intrinsic_push));
-  global_env->bind("pop", Value(&intrinsic_pop));
+void Interpreter::enable_profiling() {
+  if (m_profiler == nullptr) {
+    m_profiler = new Profiler();
+  }
+}
+
+void Interpreter::compile() {
+  assert(m_program == nullptr);
+  m_program = new Program();
+  Compiler compiler(m_program);
+  compiler.compile_unit(m_ast);
+  if (m_prelude != nullptr) {
+    std::vector<Node *> functions = Snapshot::get_functions(m_prelude);
+    for (auto i = functions.begin(); i != functions.end(); ++i) {
+      m_prelude_chunks.push_back(compiler.compile_function(*i));
+    }
+  }
+}
+
+// Give the prelude's global variables the values saved in the snapshot.
+// Its functions are created here, since the prelude isn't executed.
+void Interpreter::restore_prelude() {
+  std::vector<Node *> definitions = Snapshot::get_functions(m_prelude);
+  std::vector<Function *> functions;
+  for (size_t i = 0; i < definitions.size(); i++) {
+    Function *fn = make_function(definitions[i], m_global_env);
+    if (!m_prelude_chunks.empty()) {
+      fn->set_chunk(m_program->get_chunk(m_prelude_chunks[i]));
+    }
+    functions.push_back(fn);
+  }
+  m_snapshot->restore(m_global_env, functions, s_intrinsics, NUM_INTRINSICS);
+}
+
+// A Function for a function definition, defined in env
+Function *Interpreter::make_function(Node* func, Environment* env) {
+  std::vector<std::string> params;
+  if (func->get_num_kids() == 3) {
+    Node *plist = func->get_kid(1);
+    for (auto i = plist->cbegin(); i != plist->cend(); ++i) {
+      params.push_back((*i)->get_str());
+    }
+  }
+  return new Function(func->get_kid(0)->get_str(), params, env, func->get_last_kid());
+}
+
+// Return the interned String for a string literal. Interned Strings
+// are pinned, so they live as long as the Interpreter, and tasks can
+// use them too.
+String *Interpreter::intern_string(const std::string &text) {
+  auto i = m_strings.find(text);
+  if (i != m_strings.end()) {
+    return i->second;
+  }
+  String *str = new String(text);
+  str->freeze();
+  m_heap.pin(str);
+  m_strings.emplace(text, str);
+  return str;
+}
+
+// If a (resolved) variable reference refers to the global variable
+// holding an intrinsic, return the intrinsic's slot, otherwise -1
+int Interpreter::global_intrinsic_slot(Node* varref, Scope* scope) {
+  if (varref->get_depth() == scope->get_level() && varref->get_slot() < int(NUM_INTRINSICS)) {
+    return varref->get_slot();
+  }
+  return -1;
+}
 
-  global_env->bind("strlen", Value(&intrinsic_strlen));
-  global_env->bind("strcat", Value(&intrinsic_strcat));
-  global_env->bind("substr", Value(&intrinsic_substr));
-  analyze_recurse(m_ast, global_env.release());
-  // implement
+// A global variable may be defined (once) with the name of an
+// intrinsic added after the original ones, replacing it: the vardef is given the variable's
+// lexical address, so that it resets the variable to 0 when it
+// is executed. Returns false if the name can't be reused.
+bool Interpreter::shadow_intrinsic(Node* vardef, Scope* scope) {
+  int depth, slot;
+  if (scope->get_level() != 0 || !scope->lookup(vardef->get_kid(0)->get_str(), depth, slot) ||
+      slot < int(NUM_RESERVED_INTRINSICS) || slot >= int(NUM_INTRINSICS) ||
+      m_intrinsic_shadowed[slot]) {
+    return false;
+  }
+  m_intrinsic_shadowed[slot] = true;
+  m_intrinsic_rebound[slot] = true;
+  vardef->set_lexical_address(0, slot);
+  return true;
 }
 
-void Interpreter::analyze_recurse(Node* cur_ast_node, Environment* env) {
+// Bind each intrinsic call site to the intrinsic's registry entry,
+// unless the intrinsic's global variable can be changed or the call
+// has the wrong number of arguments (in which case it is left to
+// fail at runtime)
+void Interpreter::bind_intrinsic_calls() {
+  for (auto i = m_intrinsic_calls.begin(); i != m_intrinsic_calls.end(); ++i) {
+    Node *call = *i;
+    int slot = call->get_kid(0)->get_slot();
+    unsigned num_args = call->get_num_kids() == 2 ? call->get_kid(1)->get_num_kids() : 0;
+    if (!m_intrinsic_rebound[slot] && s_intrinsics[slot].has_fast_entry(num_args)) {
+      call->set_intrinsic(&s_intrinsics[slot]);
+    }
+  }
+  m_intrinsic_calls.clear();
+}
+
+// Mark the calls in tail position in a function body: calls whose value
+// becomes the function's result with nothing left to do afterwards but
+// discard the function's environments. Besides a call that is the last
+// statement, this recognizes the usual way of choosing a result, since
+// if statements have no value:
+//
+//   var r; if (n == 0) { r = acc; } else { r = f(n - 1, acc + n); } r;
+//
+// (or just `r = f(...);` or `r = f(...); r;`) where r is a parameter
+// or a variable local to the body.
+void Interpreter::mark_tail_calls(Node* body) {
+  unsigned num_stmts = body->get_num_kids();
+  if (num_stmts == 0) {
+    return;
+  }
+
+  Node *last = body->get_kid(num_stmts - 1)->get_kid(0);
+  switch (last->get_tag()) {
+  case AST_FNCALL:
+    last->set_tail_call(true);
+    break;
+  case AST_ASSIGN: {
+    Node *var = last->get_kid(0);
+    if (var->get_depth() <= 1) {
+      mark_tail_assignment(body->get_kid(num_stmts - 1), var->get_depth(), var->get_slot());
+    }
+    break;
+  }
+  case AST_VARREF:
+    if (last->get_depth() <= 1 && num_stmts >= 2) {
+      mark_tail_assignment(body->get_kid(num_stmts - 2), last->get_depth(), last->get_slot());
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Mark the call in a statement of the form `var = call(...)`, where var
+// has the lexical address (depth, slot), or in the same kind of statement
+// at the end of either branch of an if statement
+void Interpreter::mark_tail_assignment(Node* stmt, int depth, int slot) {
+  Node *node = stmt->get_kid(0);
+  if (node->get_tag() == AST_ASSIGN) {
+    Node *var = node->get_kid(0), *rhs = node->get_kid(1);
+    if (var->get_depth() == depth && var->get_slot() == slot && rhs->get_tag() == AST_FNCALL) {
+      rhs->set_tail_call(true);
+    }
+  } else if (node->get_tag() == AST_IF) {
+    // the branches are one scope deeper
+    for (unsigned i = 1; i < node->get_num_kids(); i++) {
+      Node *branch = node->get_kid(i);
+      if (branch->get_num_kids() > 0) {
+        mark_tail_assignment(branch->get_last_kid(), depth + 1, slot);
+      }
+    }
+  }
+}
+
+// Record the lexical address of a variable reference,
+// raising an error if the name is not defined
+void Interpreter::resolve_variable(Node* varref, Scope* scope) {
+  int depth, slot;
+  if (!scope->lookup(varref->get_str(), depth, slot)) {
+    EvaluationError::raise(varref->get_loc(), "Undefined reference to %s.", varref->get_str().c_str());
+  }
+  varref->set_lexical_address(depth, slot);
+  if (m_global_refs != nullptr && depth == scope->get_level()) {
+    m_global_refs->push_back(slot);
+  }
+}
+
+void Interpreter::analyze_recurse(Node* cur_ast_node, Scope* scope) {
   int cur_tag = cur_ast_node->get_tag();
 
   switch (cur_tag) {
 
     case AST_ARGLIST:
-      for (auto i = cur_ast_node->cbegin(); i != cur_ast_node->cend(); i++) {
-        analyze_recurse(*i, env);
-      }
     case AST_UNIT:
     case AST_STATEMENT:
       for (auto i = cur_ast_node->cbegin(); i != cur_ast_node->cend(); i++ ) {
-        analyze_recurse(*i, env);
+        analyze_recurse(*i, scope);
       }
       return;
 
     case AST_PARAMETER_LIST:
       for (auto i = cur_ast_node->cbegin(); i != cur_ast_node->cend(); i++) {
-        env->define_variable((*i)->get_str());
+        scope->define_variable((*i)->get_str());
       }
       return;
 
     case AST_FUNC: {
+      Node *name = cur_ast_node->get_kid(0);
+      scope->define_variable(name->get_str());
+      resolve_variable(name, scope);
+      int intrinsic_slot = global_intrinsic_slot(name, scope);
+      if (intrinsic_slot >= 0) {
+        m_intrinsic_rebound[intrinsic_slot] = true;
+      }
+      // the Function will capture the environment of the defining scope
+      scope->mark_captured();
 
-      env->define_variable(cur_ast_node->get_kid(0)->get_str());
-
-      auto func_env = std::unique_ptr<Environment>(new Environment(env));
+      // the parameters and the body each get their own scope,
+      // matching the two Environments created for each call
+      Scope func_scope(scope);
 
       if (cur_ast_node->get_num_kids() == 3) {
         for (auto i = cur_ast_node->get_kid(1)->cbegin() ; i != cur_ast_node->get_kid(1)->cend(); i++) {
-          func_env->define_variable((*i)->get_str());
+          func_scope.define_variable((*i)->get_str());
         }
         
       }
 
-      auto func_env_pass = std::unique_ptr<Environment>(new Environment(func_env.release()));
+      Scope body_scope(&func_scope);
 
-      for (auto i = cur_ast_node->get_last_kid()->cbegin(); i != cur_ast_node->get_last_kid()->cend(); i++) {
-        analyze_recurse(*i, func_env_pass.get());
+      Node *body = cur_ast_node->get_last_kid();
+      std::vector<int> global_refs;
+      m_global_refs = &global_refs;
+      for (auto i = body->cbegin(); i != body->cend(); i++) {
+        analyze_recurse(*i, &body_scope);
       }
+      m_global_refs = nullptr;
+      std::sort(global_refs.begin(), global_refs.end());
+      global_refs.erase(std::unique(global_refs.begin(), global_refs.end()), global_refs.end());
+      body->set_global_refs(global_refs);
+      body->set_num_slots(body_scope.get_num_slots());
+      // the parameter environment is captured whenever the body's is
+      body->set_frame_escapes(body_scope.is_captured());
+      mark_tail_calls(body);
       return;
     }
       
     case AST_VARDEF:
 
-      if (env->define_variable(cur_ast_node->get_kid(0)->get_str())) {
+      if (scope->define_variable(cur_ast_node->get_kid(0)->get_str()) && !shadow_intrinsic(cur_ast_node, scope)) {
         EvaluationError::raise(cur_ast_node->get_loc(), "Reference %s already defined", cur_ast_node->get_str().c_str());
       }
-      analyze_recurse(cur_ast_node->get_kid(0), env);
+      analyze_recurse(cur_ast_node->get_kid(0), scope);
       return;
     case AST_FNCALL:
-      if ((env->get_variable(cur_ast_node->get_kid(0)->get_str()))==nullptr) {
-        EvaluationError::raise(cur_ast_node->get_loc(), "Undefined reference to %s.", cur_ast_node->get_str().c_str());
+      resolve_variable(cur_ast_node->get_kid(0), scope);
+      if (global_intrinsic_slot(cur_ast_node->get_kid(0), scope) >= 0) {
+        m_intrinsic_calls.push_back(cur_ast_node);
       }
       if (cur_ast_node->get_num_kids() == 2) {
-        analyze_recurse(cur_ast_node->get_last_kid(), env);
+        analyze_recurse(cur_ast_node->get_last_kid(), scope);
       }
       return;
     case AST_VARREF:
-      if ((env->get_variable(cur_ast_node->get_str()))==nullptr) {
-        EvaluationError::raise(cur_ast_node->get_loc(), "Undefined reference to %s.", cur_ast_node->get_str().c_str());
+      resolve_variable(cur_ast_node, scope);
+      return;
+    case AST_ASSIGN: {
+      for (auto i = cur_ast_node->cbegin(); i != cur_ast_node->cend(); i++) {
+        analyze_recurse(*i, scope);
+      }
+      int intrinsic_slot = global_intrinsic_slot(cur_ast_node->get_kid(0), scope);
+      if (intrinsic_slot >= 0) {
+        m_intrinsic_rebound[intrinsic_slot] = true;
       }
-      
       return;
+    }
     case AST_STRING:
-    case AST_INT_LITERAL:
+      cur_ast_node->set_literal(Value(intern_string(cur_ast_node->get_str())));
       return;
-    case AST_IF: {
-      auto if_env = std::unique_ptr<Environment>(new Environment(env));
-      for (auto i = cur_ast_node->cbegin(); i != cur_ast_node->cend(); i++) {
-        analyze_recurse(*i, if_env.get());
+    case AST_INT_LITERAL:
+      try {
+        cur_ast_node->set_literal(Value(std::stoi(cur_ast_node->get_str())));
+      } catch (std::out_of_range &ex) {
+        EvaluationError::raise(cur_ast_node->get_loc(), "Integer literal %s is out of range", cur_ast_node->get_str().c_str());
       }
       return;
-    }
-
+    case AST_IF:
     case AST_WHILE: {
-      auto while_env = std::unique_ptr<Environment>(new Environment(env));
+      Scope block_scope(scope);
       for (auto i = cur_ast_node->cbegin(); i != cur_ast_node->cend(); i++) {
-        analyze_recurse(*i, while_env.get());
+        analyze_recurse(*i, &block_scope);
       }
+      cur_ast_node->set_num_slots(block_scope.get_num_slots());
+      cur_ast_node->set_frame_escapes(block_scope.is_captured());
       return;
     }
 
-
     default:
     {
       for (auto i = cur_ast_node->cbegin(); i != cur_ast_node->cend(); i++) {
-        analyze_recurse(*i, env);
+        analyze_recurse(*i, scope);
       }
       return;
     }    
@@ -137,31 +584,323 @@ void Interpreter::analyze_recurse(Node* cur_ast_node, Environment* env) {
 }
 
 Value Interpreter::execute() {
+  Heap::Activation activation(&m_heap);
   Value result;
 
+  assert(m_global_env == nullptr);
   auto cur_node = m_ast;
-  auto global_env = std::unique_ptr<Environment>(new Environment());
-  global_env->bind("print", Value(&intrinsic_print));
-  global_env->bind("println", Value(&intrinsic_println));
-  global_env->bind("readint", Value(&intrinsic_readint));
+  // the profiler works on the AST, so it uses the tree-walking evaluator
+  bool use_vm = m_mode == EXECUTE_BYTECODE && m_profiler == nullptr;
+  if (use_vm && m_program == nullptr) {
+    compile();
+  }
 
-  global_env->bind("get", Value(&intrinsic_get));
-  global_env->bind("set", Value(&intrinsic_set));
-  global_env->bind("mkarr", Value(&intrinsic_mkarr));
-  global_env->bind("len", Value(&intrinsic_len));
-  global_env->bind("push", Value(&intrinsic_push));
-  global_env->bind("pop", Value(&intrinsic_pop));
+  m_global_env = Environment::create(nullptr, m_ast->get_num_slots());
+  for (unsigned i = 0; i < NUM_INTRINSICS; i++) {
+    m_global_env->get_slot(i) = Value(&s_intrinsics[i]);
+  }
+  if (m_snapshot != nullptr) {
+    restore_prelude();
+  }
+
+  if (use_vm) {
+    VM vm(this, m_program);
+    m_vm = &vm;
+    try {
+      result = vm.run(m_global_env);
+    } catch (...) {
+      m_vm = nullptr;
+      throw;
+    }
+    m_vm = nullptr;
+  } else {
+    m_env_roots.push_back(m_global_env);
+    result = m_profiler != nullptr ? execute_recurse<true>(cur_node, m_global_env)
+                                   : execute_recurse<false>(cur_node, m_global_env);
+    m_env_roots.pop_back();
+  }
+
+  finish_tasks();
+  m_output.flush();
+  return result;
+}
+
+Value Interpreter::run_task(const Value &fn, std::vector<Value> &args, const Location &loc) {
+  Heap::Activation activation(&m_heap);
+  Value result;
 
-  global_env->bind("strlen", Value(&intrinsic_strlen));
-  global_env->bind("strcat", Value(&intrinsic_strcat));
-  global_env->bind("substr", Value(&intrinsic_substr));
+  {
+    // fn and args are roots (they aren't reachable otherwise)
+    TempRoots roots(this);
+    roots.push(fn);
+    for (auto i = args.begin(); i != args.end(); ++i) {
+      roots.push(*i);
+    }
+    Value *call_args = roots.get() + 1;
+    unsigned num_args = unsigned(args.size());
+
+    if (fn.get_kind() == VALUE_INTRINSIC_FN) {
+      result = fn.get_intrinsic()->call(call_args, num_args, loc, this);
+    } else if (fn.get_function()->get_chunk() != nullptr) {
+      VM vm(this, m_program);
+      m_vm = &vm;
+      try {
+        result = vm.call(m_global_env, fn, call_args, num_args);
+      } catch (...) {
+        m_vm = nullptr;
+        throw;
+      }
+      m_vm = nullptr;
+    } else {
+      m_env_roots.push_back(m_global_env);
+      result = call_function<false>(fn, call_args, num_args);
+      m_env_roots.pop_back();
+    }
+  }
 
-  result = execute_recurse(cur_node, global_env.release());
+  finish_tasks();
+  m_output.flush();
 
+  // free everything but the result, so that the task only holds on
+  // to what its joiner needs
+  m_global_env = nullptr;
+  m_heap.collect([&result](Heap &heap) {
+    heap.mark_value(result);
+  });
   return result;
 }
 
+// Start a task calling fn(args) in a new interpreter, with copies of
+// fn and args, and of the global variables that they can reach
+Task *Interpreter::spawn_task(const Value &fn, const Value args[], unsigned num_args, const Location &loc) {
+  // the AST can't be changed once another thread may be using it
+  m_quicken = false;
+
+  Interpreter *task_interp = new Interpreter(this);
+  Value task_fn;
+  std::vector<Value> task_args;
+  {
+    Heap::Activation activation(&task_interp->m_heap);
+    ValueCopier copier;
+    task_interp->m_global_env = copier.copy_globals(m_global_env);
+    task_fn = copier.copy(fn);
+    for (unsigned i = 0; i < num_args; i++) {
+      task_args.push_back(copier.copy(args[i]));
+    }
+  }
+  auto state = std::make_shared<Task::State>(task_interp, task_fn, std::move(task_args), loc);
+
+  // forget the tasks that are done with, now and then
+  if (m_tasks.size() >= 64 && (m_tasks.size() & (m_tasks.size() - 1)) == 0) {
+    m_tasks.erase(std::remove_if(m_tasks.begin(), m_tasks.end(), [](const std::shared_ptr<Task::State> &task) {
+      return task->is_finished_with();
+    }), m_tasks.end());
+  }
+  m_tasks.push_back(state);
+
+  ThreadPool::get_shared()->submit([state] { state->run(); });
+  return new Task(state);
+}
+
+// Wait for the tasks this interpreter spawned, and write the output
+// of the ones that weren't joined (in the order they were spawned).
+// Their errors are ignored, since nothing asked for their results.
+void Interpreter::finish_tasks() {
+  for (auto i = m_tasks.begin(); i != m_tasks.end(); ++i) {
+    (*i)->wait();
+    std::string output = (*i)->take_output();
+    m_output.write(output.data(), output.size());
+  }
+  m_tasks.clear();
+}
+
+void Interpreter::collect_garbage() {
+  m_heap.collect([this](Heap &heap) {
+    heap.mark(m_global_env);
+    heap.mark_value(m_tail_fn);
+    for (auto i = m_tail_args.begin(); i != m_tail_args.end(); ++i) {
+      heap.mark_value(*i);
+    }
+    for (auto i = m_env_roots.begin(); i != m_env_roots.end(); ++i) {
+      heap.mark(*i);
+    }
+    for (auto i = m_temp_roots.begin(); i != m_temp_roots.end(); ++i) {
+      heap.mark_value(*i);
+    }
+    if (m_vm != nullptr) {
+      m_vm->mark_roots(heap);
+    }
+  });
+}
+
+// Call a user function with the given arguments (which are moved into
+// the parameter environment). A tail call made by the function's body
+// is left pending until the body finishes, and then made here by
+// reusing the same C++ stack frame, so tail recursion runs in
+// constant stack space.
+template<bool PROFILE>
+Value Interpreter::call_function(Value fn_val, Value args[], unsigned num_args) {
+  std::vector<Value> tail_args;
+
+  // the caller keeps fn_val and the arguments reachable
+  if (m_heap.should_collect()) {
+    collect_garbage();
+  }
+
+  for (;;) {
+    Function *f = fn_val.get_function();
+    Value result;
+    {
+      std::optional<Profiler::FunctionScope> profile;
+      if (PROFILE) {
+        profile.emplace(m_profiler, f);
+      }
+      FrameArena *arena = frame_arena_for(f->get_body());
+      ScopedEnvironment func_env(this, Environment::create(f->get_parent_env(), num_args, arena));
+      for (unsigned i = 0; i < num_args; i++) {
+        func_env->get_slot(i) = std::move(args[i]);
+      }
+
+      ScopedEnvironment func_env_pass(this, Environment::create(func_env.get(), f->get_body()->get_num_slots(), arena));
+      result = execute_recurse<PROFILE>(f->get_body(), func_env_pass.get());
+    }
+
+    if (!m_tail_call_pending) {
+      return result;
+    }
+
+    // (m_tail_fn and m_tail_args are roots)
+    if (m_heap.should_collect()) {
+      collect_garbage();
+    }
+
+    m_tail_call_pending = false;
+    fn_val = m_tail_fn;
+    m_tail_fn = Value();
+    tail_args.swap(m_tail_args);
+    m_tail_args.clear();
+    args = tail_args.data();
+    num_args = unsigned(tail_args.size());
+  }
+}
+
+// Call an intrinsic that was bound to the call site during analysis:
+// the number of arguments is known to be right, so only their kinds
+// have to be checked
+template<bool PROFILE>
+Value Interpreter::call_bound_intrinsic(Node* call, Environment* env) {
+  const Intrinsic *intrinsic = call->get_intrinsic();
+  Node *arglist = call->get_kid(1);
+
+  // the arguments evaluated so far must survive a collection
+  // while the rest are evaluated
+  TempRoots roots(this);
+  for (int i = 0; i < intrinsic->arity; i++) {
+    roots.push(execute_recurse<PROFILE>(arglist->get_kid(i), env));
+  }
+  Value *args = roots.get();
+  intrinsic->check_kinds(args, call->get_loc());
+
+  switch (intrinsic->arity) {
+  case 1:
+    return intrinsic->fn1(args[0], call->get_loc(), this);
+  case 2:
+    return intrinsic->fn2(args[0], args[1], call->get_loc(), this);
+  default:
+    return intrinsic->fn3(args[0], args[1], args[2], call->get_loc(), this);
+  }
+}
+
+// Environments for scopes that escape analysis found are never
+// captured come from the frame arena, the rest from the heap
+FrameArena *Interpreter::frame_arena_for(Node* scope_node) {
+  return scope_node->frame_escapes() ? nullptr : &m_frame_arena;
+}
+
+void Interpreter::check_int_operands(Node* node, const Value &val1, const Value &val2) {
+  if (val1.get_kind() != VALUE_INT) {
+    EvaluationError::raise(node->get_kid(0)->get_loc(), "Invalid type.");
+  } else if (val2.get_kind() != VALUE_INT) {
+    EvaluationError::raise(node->get_kid(1)->get_loc(), "Invalid type.");
+  }
+}
+
+int Interpreter::int_divide(Node* node, int a, int b) {
+  if (b == 0) {
+    EvaluationError::raise(node->get_loc(), "Divide by zero error.");
+  }
+  return a / b;
+}
+
+void Interpreter::quicken(Node* node, int quick_tag) {
+  if (m_quicken && !node->is_deoptimized()) {
+    node->set_tag(quick_tag);
+    m_num_quickened++;
+  }
+}
+
+void Interpreter::deoptimize(Node* node, int generic_tag) {
+  if (!m_quicken) {
+    return;
+  }
+  node->set_tag(generic_tag);
+  node->set_deoptimized();
+  m_num_deoptimized++;
+}
+
+// Evaluate an operand of a quickened node
+inline Value Interpreter::execute_operand(Node* node, Environment* env) {
+  switch (node->get_tag()) {
+  case AST_VARREF:
+    return env->lookup(node->get_depth(), node->get_slot());
+  case AST_INT_LITERAL:
+    return node->get_literal();
+  default:
+    return execute_recurse<false>(node, env);
+  }
+}
+
+// Evaluate a node: when profiling, the evaluation is recorded by the
+// Profiler, otherwise this is just execute_node()
+template<bool PROFILE>
 Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
+  if (PROFILE) {
+    Profiler::NodeScope profile(m_profiler, cur_ast_node);
+    return execute_node<PROFILE>(cur_ast_node, env);
+  }
+  return execute_node<PROFILE>(cur_ast_node, env);
+}
+
+// The int operators: the first time one is executed (except when
+// profiling) its node is quickened, i.e. rewritten in to the _INT
+// form of the operator, which evaluates variable and literal operands
+// in place and checks both operands' kinds at once. If a quickened
+// node ever sees a non-int operand it goes back to the generic form,
+// which reports the error.
+#define INT_BINARY_NODE(tag, expr)                                      \
+    case tag: {                                                         \
+      Value lhs = execute_recurse<PROFILE>(cur_ast_node->get_kid(0), env); \
+      Value rhs = execute_recurse<PROFILE>(cur_ast_node->get_kid(1), env); \
+      check_int_operands(cur_ast_node, lhs, rhs);                       \
+      if (!PROFILE) {                                                   \
+        quicken(cur_ast_node, tag##_INT);                               \
+      }                                                                 \
+      int a = lhs.get_ival(), b = rhs.get_ival();                       \
+      return Value(expr);                                               \
+    }                                                                   \
+    case tag##_INT: {                                                   \
+      Value lhs = execute_operand(cur_ast_node->get_kid(0), env);       \
+      Value rhs = execute_operand(cur_ast_node->get_kid(1), env);       \
+      if (!Value::both_int(lhs, rhs)) {                                 \
+        deoptimize(cur_ast_node, tag);                                  \
+        check_int_operands(cur_ast_node, lhs, rhs);                     \
+      }                                                                 \
+      int a = lhs.get_ival(), b = rhs.get_ival();                       \
+      return Value(expr);                                               \
+    }
+
+template<bool PROFILE>
+Value Interpreter::execute_node(Node* cur_ast_node, Environment* env) {
 
   int cur_tag = cur_ast_node->get_tag();
 
@@ -174,108 +913,55 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
         auto next = i + 1;
         if (next == cur_ast_node->cend()) {
 
-          auto cur_val=  execute_recurse(*i, env);
+          auto cur_val=  execute_recurse<PROFILE>(*i, env);
           return cur_val;
         }
-        execute_recurse(*i, env); 
+        execute_recurse<PROFILE>(*i, env); 
       }
       return Value(0);
 
     case AST_STRING:
-      return Value(new String(cur_ast_node->get_str()));
     case AST_INT_LITERAL:
-      return Value(std::stoi(cur_ast_node->get_str()));
+      return cur_ast_node->get_literal();
     case AST_VARREF:
-      return *env->get_variable(cur_ast_node->get_str());
+      return env->lookup(cur_ast_node->get_depth(), cur_ast_node->get_slot());
     case AST_VARDEF:
-      env->define_variable(cur_ast_node->get_kid(0)->get_str());
+      // the variable's slot was allocated (and set to 0) when
+      // the environment was created, unless it replaces an intrinsic
+      if (cur_ast_node->has_lexical_address()) {
+        env->get_slot(cur_ast_node->get_slot()) = Value(0);
+      }
       return Value(0);
     case AST_ASSIGN:
     {
       auto lhs = cur_ast_node->get_kid(0);
       auto rhs = cur_ast_node->get_kid(1);
 
-      auto rhs_val = execute_recurse(rhs, env);
+      auto rhs_val = execute_recurse<PROFILE>(rhs, env);
 
 
-      env->assign_variable(lhs->get_str(), rhs_val);
+      env->lookup(lhs->get_depth(), lhs->get_slot()) = rhs_val;
 
       return rhs_val;
     }
       
-    case AST_ADD:
-      {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        return Value(val1.get_ival() + val2.get_ival()); 
-      }
-    case AST_SUB:
-      {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        return Value(val1.get_ival() - val2.get_ival()); 
-      }
-    case AST_MULTIPLY:
-          {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        return Value(val1.get_ival() * val2.get_ival()); 
-      }
-
-    case AST_DIVIDE:
-              {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
+    INT_BINARY_NODE(AST_ADD, a + b)
+    INT_BINARY_NODE(AST_SUB, a - b)
+    INT_BINARY_NODE(AST_MULTIPLY, a * b)
+    INT_BINARY_NODE(AST_DIVIDE, int_divide(cur_ast_node, a, b))
+    INT_BINARY_NODE(AST_LT, a < b ? 1 : 0)
+    INT_BINARY_NODE(AST_LTE, a <= b ? 1 : 0)
+    INT_BINARY_NODE(AST_GT, a > b ? 1 : 0)
+    INT_BINARY_NODE(AST_GTE, a >= b ? 1 : 0)
+    INT_BINARY_NODE(AST_EQ, a == b ? 1 : 0)
+    INT_BINARY_NODE(AST_NOT_EQ, a != b ? 1 : 0)
 
-        if (val2.get_ival() == 0) {
-          EvaluationError::raise(cur_ast_node->get_loc(), 
-          "Divide by zero error.");
-        }
-
-        return Value(val1.get_ival() / val2.get_ival()); 
-      }
     case AST_LOGICAL_AND:
               {
         auto child_1 = cur_ast_node->get_kid(0);
         auto child_2 = cur_ast_node->get_kid(1);
 
-        auto val1 = execute_recurse(child_1, env);
+        auto val1 = execute_recurse<PROFILE>(child_1, env);
 
         if (val1.get_kind() != VALUE_INT) {
           EvaluationError::raise(child_1->get_loc(), "Invalid type.");
@@ -285,7 +971,7 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
           return Value(0);
         }
 
-        auto val2 = execute_recurse(child_2, env);
+        auto val2 = execute_recurse<PROFILE>(child_2, env);
 
         if (val2.get_kind() != VALUE_INT) {
           EvaluationError::raise(child_2->get_loc(), "Invalid type.");
@@ -299,7 +985,7 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
         auto child_2 = cur_ast_node->get_kid(1);
         
 
-        auto val1 = execute_recurse(child_1, env);
+        auto val1 = execute_recurse<PROFILE>(child_1, env);
 
         if (val1.get_kind() != VALUE_INT) {
           EvaluationError::raise(child_1->get_loc(), "Invalid type.");
@@ -309,7 +995,7 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
           return Value(1);
         }
 
-        auto val2 = execute_recurse(child_2, env);
+        auto val2 = execute_recurse<PROFILE>(child_2, env);
 
         if (val2.get_kind() != VALUE_INT) {
           EvaluationError::raise(child_2->get_loc(), "Invalid type.");
@@ -317,117 +1003,9 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
         
         return Value(val2.get_ival() != 0); 
       }
-    case AST_GT:
-    {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        auto ret_val = (val1.get_ival() > val2.get_ival()) ? 1 : 0;
-        
-        return Value(ret_val); 
-      }
-
-    case AST_GTE:
-    {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        auto ret_val = (val1.get_ival() >= val2.get_ival()) ? 1 : 0;
-        
-        return Value(ret_val); 
-      }
-
-    case AST_LT:
-    {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        auto ret_val = (val1.get_ival() < val2.get_ival()) ? 1 : 0;
-        
-        return Value(ret_val); 
-      }
-
-    case AST_LTE:
-    {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        auto ret_val = (val1.get_ival() <= val2.get_ival()) ? 1 : 0;
-        
-        return Value(ret_val); 
-      }
-
-        case AST_EQ:
-    {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        auto ret_val = (val1.get_ival() == val2.get_ival()) ? 1 : 0;
-        
-        return Value(ret_val); 
-      }
-
-    // AST_NOT_EQ
-    case AST_NOT_EQ:
-    {
-        auto child_1 = cur_ast_node->get_kid(0);
-        auto child_2 = cur_ast_node->get_kid(1);
-
-        auto val1 = execute_recurse(child_1, env);
-        auto val2 = execute_recurse(child_2, env);
-        if (val1.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_1->get_loc(), "Invalid type.");
-        } else if ( val2.get_kind() != VALUE_INT) {
-          EvaluationError::raise(child_2->get_loc(), "Invalid type.");
-        }
-
-        auto ret_val = (val1.get_ival() != val2.get_ival()) ? 1 : 0;
-        
-        return Value(ret_val); 
-    }    
     case AST_IF: {
 
-      auto if_env = std::unique_ptr<Environment>(new Environment(env));
+      ScopedEnvironment if_env(this, Environment::create(env, cur_ast_node->get_num_slots(), frame_arena_for(cur_ast_node)));
 
       int num_children = cur_ast_node->get_num_kids();
 
@@ -435,18 +1013,18 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
       auto true_case = cur_ast_node->get_kid(1);
 
 
-      auto val_condition = execute_recurse(condition, if_env.get());
+      auto val_condition = execute_recurse<PROFILE>(condition, if_env.get());
 
       if (val_condition.get_kind() != VALUE_INT) {
         EvaluationError::raise(condition->get_loc(), "Invalid type.");
       }
 
       if (val_condition.get_ival()) {
-        execute_recurse(true_case, if_env.get());
+        execute_recurse<PROFILE>(true_case, if_env.get());
       } else if (num_children == 3) {
 
         auto false_case = cur_ast_node->get_kid(2);
-        execute_recurse(false_case, if_env.get());
+        execute_recurse<PROFILE>(false_case, if_env.get());
       }
 
       return Value(0);
@@ -454,118 +1032,79 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
     }
     case AST_WHILE: {
 
-      auto while_env = std::unique_ptr<Environment>(new Environment(env));
+      ScopedEnvironment while_env(this, Environment::create(env, cur_ast_node->get_num_slots(), frame_arena_for(cur_ast_node)));
 
 
       auto condition = cur_ast_node->get_kid(0);
       auto true_case = cur_ast_node->get_kid(1);
 
 
-      auto val_condition = execute_recurse(condition, while_env.get());
+      auto val_condition = execute_recurse<PROFILE>(condition, while_env.get());
 
       if (val_condition.get_kind() != VALUE_INT) {
         EvaluationError::raise(condition->get_loc(), "Invalid type.");
       }
 
       while (val_condition.get_ival()) {
-        execute_recurse(true_case, while_env.get());
-        val_condition = execute_recurse(condition, while_env.get());
+        if (m_heap.should_collect()) {
+          collect_garbage();
+        }
+        execute_recurse<PROFILE>(true_case, while_env.get());
+        val_condition = execute_recurse<PROFILE>(condition, while_env.get());
       }
 
       return Value(0);
     }
     case AST_FNCALL: {
 
-      auto func_name = cur_ast_node->get_kid(0)->get_str();
-      auto fnc_val = env->get_variable(func_name);
-
-      if (fnc_val == nullptr) {
-        EvaluationError::raise(cur_ast_node->get_loc(), "Undefined refernence to %s", func_name.c_str());
+      if (cur_ast_node->get_intrinsic() != nullptr) {
+        return call_bound_intrinsic<PROFILE>(cur_ast_node, env);
       }
 
+      auto callee = cur_ast_node->get_kid(0);
+      auto func_name = callee->get_str();
+      auto fnc_val = &env->lookup(callee->get_depth(), callee->get_slot());
+
       int num_kids = cur_ast_node->get_num_kids();
+      unsigned num_args = num_kids == 2 ? cur_ast_node->get_kid(1)->get_num_kids() : 0;
 
-      if (num_kids == 1) {
-        
-        if (fnc_val->get_kind() == VALUE_FUNCTION) {
-          if (fnc_val->get_function()->get_num_params() != 0) {
-            EvaluationError::raise(cur_ast_node->get_loc(), "Invalid number of parameters for %s", func_name.c_str());
-          }
-
-          auto f = fnc_val->get_function();
-          auto func_env = std::unique_ptr<Environment>(new Environment(f->get_parent_env()));      
-          return execute_recurse(f->get_body(), func_env.release());
+      TempRoots arg_roots(this);
+      if (num_kids == 2) {
+        auto arglist_node = cur_ast_node->get_kid(1);
+        for (auto i = arglist_node->cbegin(); i != arglist_node->cend(); i++) {
+          arg_roots.push(execute_recurse<PROFILE>(*i, env));
         }
-        
-        IntrinsicFn f = fnc_val->get_intrinsic_fn();
-
-        int num_args = 0; 
-        Value args[num_args];
-
-        return f(args,num_args, cur_ast_node->get_loc(), this);
-      }
-
-
-      auto arglist_node = cur_ast_node->get_kid(1);
-
-      unsigned num_args =arglist_node->get_num_kids(); 
-
-      Value args[num_args];
-      int cnt = 0;
-
-      for (auto i = arglist_node->cbegin(); i != arglist_node->cend(); i++) {
-        args[cnt++] = execute_recurse(*i, env);
       }
-
-
+      Value *args = arg_roots.get();
 
       if (fnc_val->get_kind() == VALUE_FUNCTION) {
         if (num_args != fnc_val->get_function()->get_num_params()) {
           EvaluationError::raise(cur_ast_node->get_loc(), "Invalid number of parameters for %s", func_name.c_str());
         }
 
-        auto f = fnc_val->get_function();
-        auto func_env = std::unique_ptr<Environment>(new Environment(f->get_parent_env()));
-        for (unsigned i = 0; i < num_args; i++) {
-          auto cur_param_name = f->get_params()[i];
-          auto cur_param_value = args[i];
-          func_env->bind(cur_param_name, cur_param_value);
+        if (cur_ast_node->is_tail_call()) {
+          // leave the call to be made by call_function() once the
+          // current function's body has finished
+          m_tail_fn = *fnc_val;
+          m_tail_args.assign(std::make_move_iterator(args), std::make_move_iterator(args + num_args));
+          m_tail_call_pending = true;
+          return Value(0);
         }
 
-        auto func_env_pass = std::unique_ptr<Environment>(new Environment(func_env.release()));
-        return execute_recurse(f->get_body(), func_env_pass.release());
+        return call_function<PROFILE>(*fnc_val, args, num_args);
       }
 
-      IntrinsicFn f = fnc_val->get_intrinsic_fn();
-
-
+      if (fnc_val->get_kind() != VALUE_INTRINSIC_FN) {
+        EvaluationError::raise(cur_ast_node->get_loc(), "%s is not a function", func_name.c_str());
+      }
 
-      return f(args,num_args, cur_ast_node->get_loc(), this);
+      return fnc_val->get_intrinsic()->call(args, num_args, cur_ast_node->get_loc(), this);
 
     }
     case AST_FUNC: {
-
-      std::string func_name = cur_ast_node->get_kid(0)->get_str();
-
-      int num_params = cur_ast_node->get_num_kids();
-      auto statement_list = cur_ast_node->get_last_kid();
-
-      Node* body = statement_list;
-      auto param_names = std::vector<std::string>();
-
-      if (num_params == 3) {
-        auto arglist = cur_ast_node->get_kid(1);
-
-        for (auto i = arglist->cbegin(); i != arglist->cend(); ++i) {
-          param_names.push_back((*i)->get_str());
-        }
-      } 
-
-      Value fn_val(new Function(func_name, param_names, env, body));
-
-      env->bind(func_name, fn_val);
+      Value fn_val(make_function(cur_ast_node, env));
+      env->get_slot(cur_ast_node->get_kid(0)->get_slot()) = fn_val;
       return fn_val;
-        
     }
     default: {
       return Value(0);
@@ -575,223 +1114,288 @@ Value Interpreter::execute_recurse(Node* cur_ast_node, Environment* env) {
 
 }
 
+#undef INT_BINARY_NODE
+
+// Note that the intrinsics with a fixed number of arguments are only
+// called once the number and kinds of the arguments have been checked
+// against their registry entries (see s_intrinsics)
+
 Value Interpreter::intrinsic_print(
-    Value args[], unsigned num_args,
+    const Value &val,
     const Location &loc, Interpreter *interp) {
-  if (num_args != 1)
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to print function");
-  printf("%s", args[0].as_str().c_str());
+  interp->m_output.write_value(val);
   return Value();
 }
 
 Value Interpreter::intrinsic_println(
-    Value args[], unsigned num_args,
+    const Value &val,
     const Location &loc, Interpreter *interp) {
-  if (num_args != 1)
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to print function");
-  printf("%s\n", args[0].as_str().c_str());
+  interp->m_output.write_value(val);
+  interp->m_output.put('\n');
   return Value();
 }
 
 Value Interpreter::intrinsic_readint(
     Value args[], unsigned num_args,
     const Location &loc, Interpreter *interp) {
-  int num = 0;
-  scanf("%d", &num);
-  return Value(num);
+  if (interp->m_parent != nullptr) {
+    EvaluationError::raise(loc, "readint function can't be called by a task");
+  }
+  // anything printed so far may be a prompt for the input
+  if (interp->m_int_reader.needs_input()) {
+    interp->m_output.flush();
+  }
+  return Value(interp->m_int_reader.read_int());
 }
 
 Value Interpreter::intrinsic_mkarr(
     Value args[], unsigned num_args,
     const Location &loc, Interpreter *interp) {
 
-  std::vector<Value> arr;
-
-  for (unsigned i = 0; i < num_args; i++) {
-    arr.push_back(args[i]);
-  }
+  std::vector<Value> arr(args, args + num_args);
 
-  auto arr_val = new Array(arr);
+  auto arr_val = new Array(std::move(arr));
 
   return Value(arr_val);
 }
 
 Value Interpreter::intrinsic_len(
-    Value args[], unsigned num_args,
+    const Value &arr_val,
     const Location &loc, Interpreter *interp) {
+  return Value(arr_val.get_array()->len());
+}
 
-  if (num_args != 1) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to len function");
-  }
-
-  if (args[0].get_kind() != VALUE_ARRAY) {
-    EvaluationError::raise(
-      loc, "Wrong type of arguments passed to len function");
-
-  }
-
-  Array* arr = args[0].get_array();
-  int len = arr->len();
+Value Interpreter::intrinsic_get(
+  const Value &arr_val, const Value &index,
+  const Location &loc, Interpreter* interp) {
+  return arr_val.get_array()->get_val(index.get_ival());
+}
 
-  return Value(len);
+Value Interpreter::intrinsic_set(
+  const Value &arr_val, const Value &index, const Value &val,
+  const Location &loc, Interpreter* interp) {
+  arr_val.get_array()->set_val(val, index.get_ival());
+  return val;
 }
 
-Value Interpreter::intrinsic_get(
-  Value args[], unsigned num_args, 
+Value Interpreter::intrinsic_push(
+  const Value &arr_val, const Value &val,
   const Location &loc, Interpreter* interp) {
-    if (num_args != 2) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to get function");
-  }
+  arr_val.get_array()->push_val(val);
+  return val;
+}
 
-  if (args[0].get_kind() != VALUE_ARRAY || args[1].get_kind() != VALUE_INT) {
-    EvaluationError::raise(
-      loc, "Wrong type of arguments passed to get function");
+Value Interpreter::intrinsic_pop(
+  const Value &arr_val,
+  const Location &loc, Interpreter* interp) {
+  Array* arr = arr_val.get_array();
 
+  if (arr->is_empty()) {
+    EvaluationError::raise(loc, "Array is empty.");
   }
 
-    Array* arr = args[0].get_array();
-    int index = args[1].get_ival();
-    
-    return arr->get_val(index);
+  arr->pop_val();
 
-  }
+  return Value(0);
+}
 
-Value Interpreter::intrinsic_set(
-  Value args[], unsigned num_args, 
+Value Interpreter::intrinsic_strlen(
+  const Value &str_val,
   const Location &loc, Interpreter* interp) {
-    if (num_args != 3) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to set function");
-  }
+  return Value(str_val.get_string()->len());
+}
 
-    if (args[0].get_kind() != VALUE_ARRAY || args[1].get_kind() != VALUE_INT) {
-    EvaluationError::raise(
-      loc, "Wrong type of arguments passed to set function");
+Value Interpreter::intrinsic_substr(
+  const Value &str_val, const Value &index, const Value &num_c,
+  const Location &loc, Interpreter* interp) {
+  return Value(str_val.get_string()->substr(index.get_ival(), num_c.get_ival()));
+}
 
-    }
-    Array* arr = args[0].get_array();
-    int index = args[1].get_ival();
-    Value val = args[2];
+Value Interpreter::intrinsic_strcat(
+  const Value &str1, const Value &str2,
+  const Location &loc, Interpreter* interp) {
+  return Value(str1.get_string()->append(str2.get_string()));
+}
 
-    arr->set_val(val, index);
-    return val;
-  }
+// The bulk array intrinsics work on the whole array in native code
+// (see Array); fill, sort and reverse modify the array in place, and
+// return it
 
-Value Interpreter::intrinsic_push(
-  Value args[], unsigned num_args, 
+Value Interpreter::intrinsic_sum(
+  const Value &arr_val,
   const Location &loc, Interpreter* interp) {
-    if (num_args != 2) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to push function");
+  Array *arr = arr_val.get_array();
+  if (!arr->is_all_int()) {
+    EvaluationError::raise(loc, "Array passed to sum function contains a non-integer value");
   }
+  return Value(arr->sum_ints());
+}
 
-    if (args[0].get_kind() != VALUE_ARRAY) {
-    EvaluationError::raise(
-      loc, "Wrong type of argument passed to push function");
+Value Interpreter::intrinsic_fill(
+  const Value &arr_val, const Value &val,
+  const Location &loc, Interpreter* interp) {
+  arr_val.get_array()->fill(val);
+  return arr_val;
+}
 
-    }
+Value Interpreter::intrinsic_range(
+  const Value &start, const Value &end,
+  const Location &loc, Interpreter* interp) {
+  return Value(Array::range(start.get_ival(), end.get_ival()));
+}
 
-    Array* arr = args[0].get_array();
-    Value val = args[1];
+Value Interpreter::intrinsic_indexof(
+  const Value &arr_val, const Value &val,
+  const Location &loc, Interpreter* interp) {
+  return Value(arr_val.get_array()->index_of(val));
+}
 
-    arr->push_val(val);
-    return val;
+Value Interpreter::intrinsic_sort(
+  const Value &arr_val,
+  const Location &loc, Interpreter* interp) {
+  Array *arr = arr_val.get_array();
+  if (arr->is_all_int()) {
+    arr->sort_ints();
+  } else if (arr->is_all_string()) {
+    arr->sort_strings();
+  } else {
+    EvaluationError::raise(loc, "Array passed to sort function must contain only integers or only strings");
   }
+  return arr_val;
+}
 
+Value Interpreter::intrinsic_reverse(
+  const Value &arr_val,
+  const Location &loc, Interpreter* interp) {
+  arr_val.get_array()->reverse();
+  return arr_val;
+}
 
-
-  Value Interpreter::intrinsic_pop(
-  Value args[], unsigned num_args, 
+Value Interpreter::intrinsic_slice(
+  const Value &arr_val, const Value &index, const Value &count,
   const Location &loc, Interpreter* interp) {
-    if (num_args != 1) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to pop function");
+  Array *arr = arr_val.get_array();
+  int ind = index.get_ival(), num = count.get_ival();
+  if (ind < 0 || num < 0 || num > arr->len() - ind) {
+    EvaluationError::raise(loc, "Index out of range in slice function");
   }
+  return Value(arr->slice(ind, num));
+}
 
-    if (args[0].get_kind() != VALUE_ARRAY) {
-      EvaluationError::raise(
-      loc, "Wrong type of argument passed to pop function");
-    }
-
-    Array* arr = args[0].get_array();
-
-    if (arr->get_array().size() == 0) {
-      EvaluationError::raise(loc, "Array is empty.");
-    }
+// Map keys must be ints or strings: the kind of the key is checked
+// here, since the registry can only require one kind per argument
 
-    arr->pop_val();
-    
-    return Value(0);
+void Interpreter::check_map_key(const Value &key, const char *fn_name, const Location &loc) {
+  if (!Map::is_valid_key(key)) {
+    EvaluationError::raise(loc, "Wrong type of arguments passed to %s function", fn_name);
   }
+}
 
-  Value Interpreter::intrinsic_strlen(
-  Value args[], unsigned num_args, 
+Value Interpreter::intrinsic_mkmap(
+  Value args[], unsigned num_args,
   const Location &loc, Interpreter* interp) {
-    if (num_args != 1) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to len function");
+  if (num_args != 0) {
+    EvaluationError::raise(loc, "Wrong number of arguments passed to mkmap function");
   }
+  return Value(new Map());
+}
 
-    if (args[0].get_kind() != VALUE_STRING) {
-      EvaluationError::raise(
-      loc, "Wrong type of argument passed to len function");
-    }
-
-    String* str = args[0].get_string();
+Value Interpreter::intrinsic_mput(
+  const Value &map_val, const Value &key, const Value &val,
+  const Location &loc, Interpreter* interp) {
+  check_map_key(key, "mput", loc);
+  map_val.get_map()->put(key, val);
+  return val;
+}
 
-    return Value(str->len());
+Value Interpreter::intrinsic_mget(
+  const Value &map_val, const Value &key,
+  const Location &loc, Interpreter* interp) {
+  check_map_key(key, "mget", loc);
+  const Value *val = map_val.get_map()->find(key);
+  if (val == nullptr) {
+    EvaluationError::raise(loc, "Key %s not found in map", key.as_str().c_str());
   }
+  return *val;
+}
 
+Value Interpreter::intrinsic_mhas(
+  const Value &map_val, const Value &key,
+  const Location &loc, Interpreter* interp) {
+  check_map_key(key, "mhas", loc);
+  return Value(map_val.get_map()->find(key) != nullptr);
+}
 
-  Value Interpreter::intrinsic_substr(
-  Value args[], unsigned num_args, 
+Value Interpreter::intrinsic_mdel(
+  const Value &map_val, const Value &key,
   const Location &loc, Interpreter* interp) {
-    if (num_args != 3) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to substr function");
-  }
+  check_map_key(key, "mdel", loc);
+  return Value(map_val.get_map()->remove(key));
+}
 
-    if (args[0].get_kind() != VALUE_STRING || args[1].get_kind() != VALUE_INT || args[2].get_kind() != VALUE_INT) {
-      EvaluationError::raise(
-      loc, "Wrong type of argument passed to substr function");
-    }
+Value Interpreter::intrinsic_mkeys(
+  const Value &map_val,
+  const Location &loc, Interpreter* interp) {
+  return Value(new Array(map_val.get_map()->get_keys()));
+}
 
-    String* str = args[0].get_string();
-    int index = args[1].get_ival();
-    int num_c = args[2].get_ival();
+Value Interpreter::intrinsic_openfile(
+  const Value &filename,
+  const Location &loc, Interpreter* interp) {
+  std::string name = filename.get_string()->get_text();
+  File *file = File::open(name);
+  if (file == nullptr) {
+    EvaluationError::raise(loc, "Could not open file %s", name.c_str());
+  }
+  return Value(file);
+}
 
+Value Interpreter::intrinsic_readline(
+  const Value &file,
+  const Location &loc, Interpreter* interp) {
+  return Value(file.get_file()->read_line());
+}
 
+Value Interpreter::intrinsic_readall(
+  const Value &file,
+  const Location &loc, Interpreter* interp) {
+  return Value(file.get_file()->read_all());
+}
 
-    return Value(new String(str->substr(index, num_c)));
-  }
+Value Interpreter::intrinsic_lines(
+  const Value &file,
+  const Location &loc, Interpreter* interp) {
+  return Value(new Array(file.get_file()->read_lines()));
+}
 
-  
-  Value Interpreter::intrinsic_strcat(
-  Value args[], unsigned num_args, 
+Value Interpreter::intrinsic_spawn(
+  Value args[], unsigned num_args,
   const Location &loc, Interpreter* interp) {
-    if (num_args != 2) {
-    EvaluationError::raise(
-      loc, "Wrong number of arguments passed to strcat function");
+  if (num_args == 0) {
+    EvaluationError::raise(loc, "Wrong number of arguments passed to spawn function");
   }
-
-    if (args[0].get_kind() != VALUE_STRING || args[1].get_kind() != VALUE_STRING) {
-      EvaluationError::raise(
-      loc, "Wrong type of argument passed to strcat function");
+  const Value &fn = args[0];
+  if (fn.get_kind() == VALUE_FUNCTION) {
+    // checked now, since the task's errors aren't seen until it's joined
+    Function *f = fn.get_function();
+    if (f->get_params().size() != num_args - 1) {
+      EvaluationError::raise(loc, "Invalid number of parameters for %s", f->get_name().c_str());
     }
-
-    String* str1 = args[0].get_string();
-    String* str2 = args[1].get_string();
-
-
-
-    return Value(new String(str1->get_text() + str2->get_text()));
+  } else if (fn.get_kind() != VALUE_INTRINSIC_FN) {
+    EvaluationError::raise(loc, "Wrong type of argument passed to spawn function");
   }
+  return Value(interp->spawn_task(fn, args + 1, num_args - 1, loc));
+}
 
-
-
-
-  
\ No newline at end of file
+// Wait for a task, and return (a copy of) its result. The task's
+// output is written first, so output appears in the order that
+// tasks are joined.
+Value Interpreter::intrinsic_join(
+  const Value &task,
+  const Location &loc, Interpreter* interp) {
+  Task::State *state = task.get_task()->get_state();
+  state->wait();
+  std::string output = state->take_output();
+  interp->m_output.write(output.data(), output.size());
+  return state->get_result();
+}
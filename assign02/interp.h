@@ -3,38 +3,220 @@
 
 #include "value.h"
 #include "string.h"
+#include <map>
+#include <memory>
+#include <vector>
+#include <string>
 #include "environment.h"
+#include "frame_arena.h"
+#include "gc.h"
+#include "intrinsic.h"
+#include "int_reader.h"
+#include "output_buffer.h"
+#include "task.h"
 class Node;
+class Function;
+class Scope;
 class Location;
+class Program;
+class Profiler;
+class Snapshot;
+class VM;
+
+// How execute() runs the program: by default the AST is compiled
+// to bytecode and run on the VM, but the original tree-walking
+// evaluator is still available.
+enum ExecutionMode {
+  EXECUTE_BYTECODE,
+  EXECUTE_TREE_WALK,
+};
 
 class Interpreter {
 private:
+  // owns the program's Functions, Strings, Arrays and heap
+  // Environments, so it is destroyed last
+  Heap m_heap;
+  // the interpreter that spawned the task this one runs (if any),
+  // which owns the AST and the Program
+  Interpreter *m_parent;
   Node *m_ast;
-  
+  // the snapshot the program starts from (if any), and the AST of
+  // its prelude (owned like m_ast)
+  const Snapshot *m_snapshot;
+  Node *m_prelude;
+  // the chunks of the prelude's functions, in order
+  std::vector<int> m_prelude_chunks;
+  Program *m_program;
+  ExecutionMode m_mode;
+  // interned string literals: each String is shared by every
+  // literal with the same text, and lives as long as the Interpreter
+  // (they are pinned in the heap)
+  std::map<std::string, String *> m_strings;
+  // Environments for scopes that are never captured by a Function
+  FrameArena m_frame_arena;
+  Environment *m_global_env;
+  // call sites of intrinsics found during analysis, and which
+  // intrinsics' global variables are ever assigned or redefined
+  // (calls to those can't be bound at analysis time)
+  std::vector<Node *> m_intrinsic_calls;
+  std::vector<bool> m_intrinsic_rebound;
+  // intrinsics replaced by a global variable with the same name
+  std::vector<bool> m_intrinsic_shadowed;
+  // while a function body is analyzed, the global variables it
+  // refers to
+  std::vector<int> *m_global_refs;
+  // a tail call waiting to be made by call_function()
+  Value m_tail_fn;
+  std::vector<Value> m_tail_args;
+  bool m_tail_call_pending;
+  Profiler *m_profiler;
+  // garbage collection roots of the tree-walking evaluator: the
+  // environments of the scopes being executed, and values it is
+  // holding on to while evaluating other nodes (such as arguments)
+  std::vector<Environment *> m_env_roots;
+  std::vector<Value> m_temp_roots;
+  // the VM running the program (if any)
+  VM *m_vm;
+  // int operator nodes quickened by the tree-walking evaluator,
+  // and quickened nodes that went back to the generic form
+  unsigned long m_num_quickened, m_num_deoptimized;
+  // nodes are only quickened until a task is spawned, since tasks
+  // share the AST (so only the first interpreter ever quickens)
+  bool m_quicken;
+  // the program's output (written out when execute() finishes, or
+  // before waiting for input), and its input of ints
+  OutputBuffer m_output;
+  IntReader m_int_reader;
+  // tasks spawned by the program which haven't finished, or whose
+  // output hasn't been used yet (see finish_tasks())
+  std::vector<std::shared_ptr<Task::State>> m_tasks;
+
+  class ScopedEnvironment;
+  class TempRoots;
+
 public:
   Interpreter(Node *ast_to_adopt);
   ~Interpreter();
 
+  void set_mode(ExecutionMode mode) { m_mode = mode; }
+
+  // Start the program from the global environment saved in a snapshot
+  // (which must outlive the Interpreter), rather than from scratch.
+  // Call before analyze().
+  void start_from(const Snapshot *snapshot);
+  // Once the program has been executed, save its global environment
+  // in a snapshot file, as the prelude of later programs. parsed_ast
+  // is ASTCache::serialize() of the AST before it was analyzed.
+  void save_snapshot(const std::string &filename, const std::string &prelude_filename,
+                     const std::string &parsed_ast);
+
+  // Keep the program's output (see take_output()) and give it no
+  // input (readint returns 0), so that it can run alongside others
+  void isolate();
+
+  // Record per-node execution counts and times (see Profiler)
+  // when the program is executed. Profiling always uses the
+  // tree-walking evaluator.
+  void enable_profiling();
+  Profiler *get_profiler() const { return m_profiler; }
+
   void analyze();
+  // simplify the analyzed AST (see Optimizer), returning the
+  // number of nodes removed
+  unsigned optimize();
+  // lower the (analyzed) AST to bytecode
+  void compile();
+  Program *get_program() const { return m_program; }
+  FrameArena *get_frame_arena() { return &m_frame_arena; }
+  Heap *get_heap() { return &m_heap; }
+  unsigned long get_num_quickened() const { return m_num_quickened; }
+  unsigned long get_num_deoptimized() const { return m_num_deoptimized; }
   Value execute();
 
+  // Call a function in this (task's) interpreter: fn and args must
+  // be in its heap (see spawn_task()). Afterwards the only object
+  // left is the result.
+  Value run_task(const Value &fn, std::vector<Value> &args, const Location &loc);
+  // Return (and forget) the output of an isolated interpreter, or
+  // a task's interpreter
+  std::string take_output() { return m_output.take_output(); }
+
+  // Free the objects the program can no longer reach. This is only
+  // called by the evaluators (when the heap asks for a collection),
+  // at points where all of the values they use are roots.
+  void collect_garbage();
+
 private:
-  // TODO: private member functions
-  void analyze_recurse(Node* cur_ast_node, Environment* env);
-  Value execute_recurse(Node* cur_ast_node, Environment* env);
-  static Value intrinsic_print(Value args[], unsigned num_args,  const Location &loc, Interpreter* interp);
-  static Value intrinsic_println(Value args[], unsigned num_args,  const Location &loc, Interpreter* interp);
+  static const Intrinsic s_intrinsics[];
+  static const unsigned NUM_INTRINSICS;
+  // the intrinsics up to substr are the language's original ones,
+  // whose names can't be reused for a global variable
+  static const unsigned NUM_RESERVED_INTRINSICS;
+
+  // an interpreter for a task spawned by parent's program
+  explicit Interpreter(Interpreter *parent);
+
+  void analyze_recurse(Node* cur_ast_node, Scope* scope);
+  void resolve_variable(Node* varref, Scope* scope);
+  int global_intrinsic_slot(Node* varref, Scope* scope);
+  bool shadow_intrinsic(Node* vardef, Scope* scope);
+  void bind_intrinsic_calls();
+  String *intern_string(const std::string &text);
+  void restore_prelude();
+  Function *make_function(Node* func, Environment* env);
+  // The tree-walking evaluator is instantiated twice: with and
+  // without profiling, so it costs nothing when not profiling
+  template<bool PROFILE> Value execute_recurse(Node* cur_ast_node, Environment* env);
+  template<bool PROFILE> Value execute_node(Node* cur_ast_node, Environment* env);
+  Value execute_operand(Node* node, Environment* env);
+  static void check_int_operands(Node* node, const Value &val1, const Value &val2);
+  static int int_divide(Node* node, int a, int b);
+  void quicken(Node* node, int quick_tag);
+  void deoptimize(Node* node, int generic_tag);
+  template<bool PROFILE> Value call_function(Value fn_val, Value args[], unsigned num_args);
+  template<bool PROFILE> Value call_bound_intrinsic(Node* call, Environment* env);
+  void mark_tail_calls(Node* body);
+  void mark_tail_assignment(Node* stmt, int depth, int slot);
+  FrameArena *frame_arena_for(Node* scope_node);
+  Task *spawn_task(const Value &fn, const Value args[], unsigned num_args, const Location &loc);
+  void finish_tasks();
+  static Value intrinsic_print(const Value &val, const Location &loc, Interpreter* interp);
+  static Value intrinsic_println(const Value &val, const Location &loc, Interpreter* interp);
   static Value intrinsic_readint(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
   static Value intrinsic_mkarr(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-  static Value intrinsic_len(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-  static Value intrinsic_get(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-  static Value intrinsic_set(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-  static Value intrinsic_push(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-  static Value intrinsic_pop(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-
-  static Value intrinsic_strcat(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-  static Value intrinsic_substr(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
-  static Value intrinsic_strlen(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
+  static Value intrinsic_len(const Value &arr, const Location &loc, Interpreter* interp);
+  static Value intrinsic_get(const Value &arr, const Value &index, const Location &loc, Interpreter* interp);
+  static Value intrinsic_set(const Value &arr, const Value &index, const Value &val, const Location &loc, Interpreter* interp);
+  static Value intrinsic_push(const Value &arr, const Value &val, const Location &loc, Interpreter* interp);
+  static Value intrinsic_pop(const Value &arr, const Location &loc, Interpreter* interp);
+
+  static Value intrinsic_strcat(const Value &str1, const Value &str2, const Location &loc, Interpreter* interp);
+  static Value intrinsic_substr(const Value &str, const Value &index, const Value &num_c, const Location &loc, Interpreter* interp);
+  static Value intrinsic_strlen(const Value &str, const Location &loc, Interpreter* interp);
+
+  static Value intrinsic_sum(const Value &arr, const Location &loc, Interpreter* interp);
+  static Value intrinsic_fill(const Value &arr, const Value &val, const Location &loc, Interpreter* interp);
+  static Value intrinsic_range(const Value &start, const Value &end, const Location &loc, Interpreter* interp);
+  static Value intrinsic_indexof(const Value &arr, const Value &val, const Location &loc, Interpreter* interp);
+  static Value intrinsic_sort(const Value &arr, const Location &loc, Interpreter* interp);
+  static Value intrinsic_reverse(const Value &arr, const Location &loc, Interpreter* interp);
+  static Value intrinsic_slice(const Value &arr, const Value &index, const Value &count, const Location &loc, Interpreter* interp);
+
+  static void check_map_key(const Value &key, const char *fn_name, const Location &loc);
+  static Value intrinsic_mkmap(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
+  static Value intrinsic_mput(const Value &map, const Value &key, const Value &val, const Location &loc, Interpreter* interp);
+  static Value intrinsic_mget(const Value &map, const Value &key, const Location &loc, Interpreter* interp);
+  static Value intrinsic_mhas(const Value &map, const Value &key, const Location &loc, Interpreter* interp);
+  static Value intrinsic_mdel(const Value &map, const Value &key, const Location &loc, Interpreter* interp);
+  static Value intrinsic_mkeys(const Value &map, const Location &loc, Interpreter* interp);
+
+  static Value intrinsic_openfile(const Value &filename, const Location &loc, Interpreter* interp);
+  static Value intrinsic_readline(const Value &file, const Location &loc, Interpreter* interp);
+  static Value intrinsic_readall(const Value &file, const Location &loc, Interpreter* interp);
+  static Value intrinsic_lines(const Value &file, const Location &loc, Interpreter* interp);
+
+  static Value intrinsic_spawn(Value args[], unsigned num_args, const Location &loc, Interpreter* interp);
+  static Value intrinsic_join(const Value &task, const Location &loc, Interpreter* interp);
 
 };
 
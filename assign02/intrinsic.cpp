@@ -0,0 +1,30 @@
+#include "exceptions.h"
+#include "intrinsic.h"
+
+Value Intrinsic::call(Value args[], unsigned num_args, const Location &loc, Interpreter *interp) const {
+  if (arity == VARIADIC) {
+    return fn(args, num_args, loc, interp);
+  }
+
+  if (unsigned(arity) != num_args) {
+    raise_arity_error(loc);
+  }
+  check_kinds(args, loc);
+
+  switch (arity) {
+  case 1:
+    return fn1(args[0], loc, interp);
+  case 2:
+    return fn2(args[0], args[1], loc, interp);
+  default:
+    return fn3(args[0], args[1], args[2], loc, interp);
+  }
+}
+
+void Intrinsic::raise_arity_error(const Location &loc) const {
+  EvaluationError::raise(loc, "%s", arity_error);
+}
+
+void Intrinsic::raise_kind_error(const Location &loc) const {
+  EvaluationError::raise(loc, "%s", kind_error);
+}
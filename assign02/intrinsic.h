@@ -0,0 +1,94 @@
+#ifndef INTRINSIC_H
+#define INTRINSIC_H
+
+#include "value.h"
+class Location;
+class Interpreter;
+
+// The kind of argument an intrinsic function requires
+// for one of its parameters
+enum ParamKind {
+  PARAM_ANY = -1,
+  PARAM_INT = VALUE_INT,
+  PARAM_STRING = VALUE_STRING,
+  PARAM_ARRAY = VALUE_ARRAY,
+  PARAM_MAP = VALUE_MAP,
+  PARAM_FILE = VALUE_FILE,
+  PARAM_TASK = VALUE_TASK,
+};
+
+// Entry points for intrinsics taking exactly 1, 2, or 3 arguments.
+// These are only called once the number and kinds of the arguments
+// have been checked, so they don't check them again.
+typedef Value (*IntrinsicFn1)(const Value &a, const Location &loc, Interpreter *interp);
+typedef Value (*IntrinsicFn2)(const Value &a, const Value &b, const Location &loc, Interpreter *interp);
+typedef Value (*IntrinsicFn3)(const Value &a, const Value &b, const Value &c, const Location &loc, Interpreter *interp);
+
+// Registry entry describing one intrinsic function: its name, how many
+// arguments it takes and of what kinds, and its entry point. Intrinsics
+// with a fixed arity of 1 to 3 use one of the fast entry points; the
+// others take an argument array (IntrinsicFn) and do their own checking.
+struct Intrinsic {
+  static const int VARIADIC = -1;
+  static const int MAX_FAST_ARGS = 3;
+
+  const char *name;
+  int arity;
+  ParamKind param_kinds[MAX_FAST_ARGS];
+  // errors reported for a wrong number or kind of arguments
+  const char *arity_error;
+  const char *kind_error;
+
+  IntrinsicFn fn;
+  IntrinsicFn1 fn1;
+  IntrinsicFn2 fn2;
+  IntrinsicFn3 fn3;
+
+  constexpr Intrinsic(const char *name_, IntrinsicFn fn_)
+    : name(name_), arity(VARIADIC), param_kinds{ PARAM_ANY, PARAM_ANY, PARAM_ANY }
+    , arity_error(nullptr), kind_error(nullptr)
+    , fn(fn_), fn1(nullptr), fn2(nullptr), fn3(nullptr) { }
+
+  constexpr Intrinsic(const char *name_, IntrinsicFn1 fn_, ParamKind k1,
+                      const char *arity_err, const char *kind_err)
+    : name(name_), arity(1), param_kinds{ k1, PARAM_ANY, PARAM_ANY }
+    , arity_error(arity_err), kind_error(kind_err)
+    , fn(nullptr), fn1(fn_), fn2(nullptr), fn3(nullptr) { }
+
+  constexpr Intrinsic(const char *name_, IntrinsicFn2 fn_, ParamKind k1, ParamKind k2,
+                      const char *arity_err, const char *kind_err)
+    : name(name_), arity(2), param_kinds{ k1, k2, PARAM_ANY }
+    , arity_error(arity_err), kind_error(kind_err)
+    , fn(nullptr), fn1(nullptr), fn2(fn_), fn3(nullptr) { }
+
+  constexpr Intrinsic(const char *name_, IntrinsicFn3 fn_, ParamKind k1, ParamKind k2, ParamKind k3,
+                      const char *arity_err, const char *kind_err)
+    : name(name_), arity(3), param_kinds{ k1, k2, k3 }
+    , arity_error(arity_err), kind_error(kind_err)
+    , fn(nullptr), fn1(nullptr), fn2(nullptr), fn3(fn_) { }
+
+  // True if calls with num_args arguments can be bound
+  // directly to a fast entry point
+  bool has_fast_entry(unsigned num_args) const {
+    return arity != VARIADIC && unsigned(arity) == num_args;
+  }
+
+  // Raise an error unless the arguments (of which there must be
+  // arity) have the kinds the intrinsic requires
+  void check_kinds(const Value *args, const Location &loc) const {
+    for (int i = 0; i < arity; i++) {
+      if (param_kinds[i] != PARAM_ANY && args[i].get_kind() != ValueKind(param_kinds[i])) {
+        raise_kind_error(loc);
+      }
+    }
+  }
+
+  // Check the arguments and call the intrinsic through whichever
+  // entry point it has
+  Value call(Value args[], unsigned num_args, const Location &loc, Interpreter *interp) const;
+
+  [[noreturn]] void raise_arity_error(const Location &loc) const;
+  [[noreturn]] void raise_kind_error(const Location &loc) const;
+};
+
+#endif // INTRINSIC_H
@@ -1,7 +1,6 @@
-#include <map>
 #include <cassert>
 #include <cctype>
-#include <memory>
+#include <cstring>
 #include <string>
 #include "cpputil.h"
 #include "token.h"
@@ -12,14 +11,86 @@
 // Lexer implementation
 ////////////////////////////////////////////////////////////////////////
 
-int isquotation(int next) {
-  return next != '"';
+namespace {
+
+// character classes (the <cctype> functions need unsigned char values)
+inline bool is_space(char c) { return isspace((unsigned char) c); }
+inline bool is_alpha(char c) { return isalpha((unsigned char) c); }
+inline bool is_alnum(char c) { return isalnum((unsigned char) c); }
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// Keywords are recognized with a perfect hash of an identifier's
+// length and first character: the table is built at compile time,
+// and the static_assert checks that no two keywords share a slot,
+// so classifying an identifier takes one probe and one comparison.
+struct Keyword {
+  const char *text;
+  unsigned len;
+  enum TokenKind kind;
+};
+
+constexpr unsigned keyword_len(const char *text) {
+  unsigned len = 0;
+  while (text[len] != '\0') {
+    len++;
+  }
+  return len;
+}
+
+constexpr Keyword make_keyword(const char *text, enum TokenKind kind) {
+  return Keyword{ text, keyword_len(text), kind };
+}
+
+constexpr Keyword s_keywords[] = {
+  make_keyword("var", TOK_VARIABLE),
+  make_keyword("function", TOK_FUNCTION),
+  make_keyword("if", TOK_IF),
+  make_keyword("else", TOK_ELSE),
+  make_keyword("while", TOK_WHILE),
+};
+
+constexpr unsigned KEYWORD_TABLE_SIZE = 8;  // must be a power of 2
+
+constexpr unsigned keyword_hash(size_t len, char first) {
+  return (unsigned(len) ^ (unsigned char) first) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+struct KeywordTable {
+  Keyword slots[KEYWORD_TABLE_SIZE];
+  bool is_perfect;
+};
+
+constexpr KeywordTable make_keyword_table() {
+  KeywordTable table = {};
+  table.is_perfect = true;
+  for (const Keyword &kw : s_keywords) {
+    Keyword &slot = table.slots[keyword_hash(kw.len, kw.text[0])];
+    if (slot.len != 0) {
+      table.is_perfect = false;
+    }
+    slot = kw;
+  }
+  return table;
+}
+
+constexpr KeywordTable s_keyword_table = make_keyword_table();
+static_assert(s_keyword_table.is_perfect, "keywords collide in the keyword hash table");
+
 }
+
 Lexer::Lexer(FILE *in, const std::string &filename)
-  : m_in(in)
-  , m_filename(filename)
+  : Lexer(new InputBuffer(in, filename), filename) {
+  m_in = in;
+}
+
+Lexer::Lexer(InputBuffer *input_to_adopt, const std::string &filename)
+  : m_in(nullptr)
+  , m_input(input_to_adopt)
+  , m_file_loc(filename, 0, 0)
+  , m_pos(m_input->begin())
+  , m_end(m_input->end())
   , m_line(1)
-  , m_col(1)
+  , m_line_start(m_input->begin())
   , m_eof(false) {
 }
 
@@ -28,7 +99,10 @@ Lexer::~Lexer() {
   for (auto i = m_lookahead.begin(); i != m_lookahead.end(); ++i) {
     delete *i;
   }
-  fclose(m_in);
+  delete m_input;
+  if (m_in != nullptr) {
+    fclose(m_in);
+  }
 }
 
 Node *Lexer::next() {
@@ -56,37 +130,7 @@ Node *Lexer::peek(int how_many) {
 }
 
 Location Lexer::get_current_loc() const {
-  return Location(m_filename, m_line, m_col);
-}
-
-// Read the next character of input, returning -1 (and setting m_eof to true)
-// if the end of input has been reached.
-int Lexer::read() {
-  if (m_eof) {
-    return -1;
-  }
-  int c = fgetc(m_in);
-  if (c < 0) {
-    m_eof = true;
-  } else if (c == '\n') {
-    m_col = 1;
-    m_line++;
-  } else {
-    m_col++;
-  }
-  return c;
-}
-
-// "Unread" a character.  Useful for when reading a character indicates
-// that the current token has ended and the next one has begun.
-void Lexer::unread(int c) {
-  ungetc(c, m_in);
-  if (c == '\n') {
-    m_line--;
-    m_col = 99;
-  } else {
-    m_col--;
-  }
+  return m_file_loc.at(m_line, int(m_pos - m_line_start) + 1);
 }
 
 void Lexer::fill(int how_many) {
@@ -99,228 +143,165 @@ void Lexer::fill(int how_many) {
   }
 }
 
+// Scan the next token, returning nullptr (and setting m_eof) if the
+// input ends first
 Node *Lexer::read_token() {
-  int c, line = -1, col = -1;
-
-  // skip whitespace characters until a non-whitespace character is read
-  for (;;) {
-    line = m_line;
-    col = m_col;
-    c = read();
-    if (c < 0 || !isspace(c)) {
-      break;
+  const char *p = m_pos;
+
+  // skip whitespace
+  while (p != m_end && is_space(*p)) {
+    if (*p == '\n') {
+      m_line++;
+      m_line_start = p + 1;
     }
+    ++p;
   }
 
-  if (c < 0) {
+  if (p == m_end) {
     // reached end of file
+    m_pos = p;
+    m_eof = true;
     return nullptr;
   }
 
-  std::string lexeme;
-  lexeme.push_back(char(c));
-
-  int c_next;
-
-  if (isalpha(c)) {
-    Node *tok = read_continued_token(TOK_IDENTIFIER, lexeme, line, col, isalnum);
-
+  const char *start = p;
+  int line = m_line, col = int(start - m_line_start) + 1;
+  char c = *p++;
+  m_pos = p;
 
-    if (tok->get_str()==std::string("var")) {
-      tok->set_tag(TOK_VARIABLE);
-    } else if (tok->get_str() == std::string("function")) {
-      tok->set_tag(TOK_FUNCTION);
-    } else if (tok->get_str() == std::string("if")) {
-      tok->set_tag(TOK_IF);
-    } else if (tok->get_str() == std::string("else")) {
-      tok->set_tag(TOK_ELSE);
-    } else if (tok->get_str() == std::string("while")) {
-      tok->set_tag(TOK_WHILE);
+  if (is_alpha(c)) {
+    while (p != m_end && is_alnum(*p)) {
+      ++p;
     }
- 
-
-    return tok;
-  } else if (isdigit(c)) {
-    return read_continued_token(TOK_INTEGER_LITERAL, lexeme, line, col, isdigit);
-  } else {
-    switch (c) {
-    case '+':
-      return token_create(TOK_PLUS, lexeme, line, col);
-    case '-':
-      return token_create(TOK_MINUS, lexeme, line, col);
-    case '*':
-      return token_create(TOK_TIMES, lexeme, line, col);
-    case '/':
-      return token_create(TOK_DIVIDE, lexeme, line, col);
-    case '(':
-      return token_create(TOK_LPAREN, lexeme, line, col);
-    case ')':
-      return token_create(TOK_RPAREN, lexeme, line, col);
-    case '{':
-      return token_create(TOK_LBRACE, lexeme, line, col);
-    case '}':
-      return token_create(TOK_RBRACE, lexeme, line, col);
-    case ',':
-      return token_create(TOK_COMMA, lexeme, line, col);
-    case ';':
-      return token_create(TOK_SEMICOLON, lexeme, line, col);
-    case '|':
-      c_next = read();
-
-      if (c_next < 0) {
-        SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c);
-      } 
-      if (c_next != '|') {
-        unread(c_next);
-        SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c_next);
-      }
-      lexeme.push_back(char(c_next));
-      return token_create(TOK_OR, lexeme, line, col);
-    case '&':
-      c_next = read();
-      if (c_next < 0) {
-        SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c);
-      } 
-      if (c_next != '&') {
-        unread(c_next);
-        SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c_next);
-      }
-
-      lexeme.push_back(char(c_next));
-      return token_create(TOK_AND, lexeme, line, col);
-    case '=':
-      c_next = read();
-
-      if (c_next < 0) {
-        return nullptr;
-      }
-
-      if (c_next == '=') {
-          lexeme.push_back(c_next);
-          return token_create(TOK_EQUAL, lexeme, line, col);
-      }
-      unread(c_next);
-      return token_create(TOK_ASSIGNMENT, lexeme, line, col);
-    case '<':
-      c_next = read();
-
-      if (c_next < 0) {
-        return nullptr;
-      }
-
-      if (c_next == '=') {
-          lexeme.push_back(c_next);
-          return token_create(TOK_LESS_THAN_EQUAL, lexeme, line, col);
-      }
-      unread(c_next);
-      return token_create(TOK_LESS_THAN, lexeme, line, col);
-    case '>':
-      c_next = read();
-
-      if (c_next < 0) {
-        return nullptr;
-      }
-
-      if (c_next == '=') {
-          lexeme.push_back(c_next);
-          return token_create(TOK_GREATER_THAN_EQUAL, lexeme, line, col);
-      }
-      unread(c_next);
-      return token_create(TOK_GREATER_THAN, lexeme, line, col);
-
-    case '!':
-      c_next = read();
-
+    m_pos = p;
+    return token_create(identifier_kind(start, size_t(p - start)), start, p, line, col);
+  }
 
-      if (c_next == '=') {
-        lexeme.push_back(c_next);
-        return token_create(TOK_NOT_EQUAL, lexeme, line, col);
-      }
+  if (is_digit(c)) {
+    while (p != m_end && is_digit(*p)) {
+      ++p;
+    }
+    m_pos = p;
+    return token_create(TOK_INTEGER_LITERAL, start, p, line, col);
+  }
 
-      if (c_next >= 0) {
-        unread(c_next);
-      }
-      SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c);      
-    // add cases for other kinds of tokens
-    case '"': {
-      lexeme.pop_back();
-
-      auto tok = read_continued_token(TOK_STRING, lexeme, line, col, &isquotation);
-      read(); // skip quotation mark
-      return tok;
+  // next character, or -1 at the end of the input
+  int c_next = (p != m_end) ? (unsigned char) *p : -1;
+
+  switch (c) {
+  case '+': return token_create(TOK_PLUS, start, p, line, col);
+  case '-': return token_create(TOK_MINUS, start, p, line, col);
+  case '*': return token_create(TOK_TIMES, start, p, line, col);
+  case '/': return token_create(TOK_DIVIDE, start, p, line, col);
+  case '(': return token_create(TOK_LPAREN, start, p, line, col);
+  case ')': return token_create(TOK_RPAREN, start, p, line, col);
+  case '{': return token_create(TOK_LBRACE, start, p, line, col);
+  case '}': return token_create(TOK_RBRACE, start, p, line, col);
+  case ',': return token_create(TOK_COMMA, start, p, line, col);
+  case ';': return token_create(TOK_SEMICOLON, start, p, line, col);
+
+  case '|':
+  case '&':
+    // only valid doubled
+    if (c_next != c) {
+      raise_unrecognized(c_next < 0 ? c : c_next);
+    }
+    m_pos = p + 1;
+    return token_create(c == '|' ? TOK_OR : TOK_AND, start, m_pos, line, col);
+
+  case '=':
+  case '<':
+  case '>':
+    if (c_next < 0) {
+      // a trailing operator at the end of the input is dropped
+      m_eof = true;
+      return nullptr;
+    }
+    if (c_next == '=') {
+      m_pos = p + 1;
+      return token_create(c == '=' ? TOK_EQUAL : c == '<' ? TOK_LESS_THAN_EQUAL : TOK_GREATER_THAN_EQUAL,
+                          start, m_pos, line, col);
     }
+    return token_create(c == '=' ? TOK_ASSIGNMENT : c == '<' ? TOK_LESS_THAN : TOK_GREATER_THAN,
+                        start, p, line, col);
 
-    default:
-      SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c);
+  case '!':
+    if (c_next != '=') {
+      raise_unrecognized(c);
     }
+    m_pos = p + 1;
+    return token_create(TOK_NOT_EQUAL, start, m_pos, line, col);
 
+  case '"':
+    return read_string(line, col);
+
+  default:
+    raise_unrecognized((unsigned char) c);
   }
 }
-// Helper function to create a Node object to represent a token.
-Node *Lexer::token_create(enum TokenKind kind, const std::string &lexeme, int line, int col) {
-  Node *token = new Node(kind, lexeme);
-  Location source_info(m_filename, line, col);
-  token->set_loc(source_info);
-  return token;
-}
 
-// Read the continuation of a (possibly) multi-character token, such as
-// an identifier or integer literal.  pred is a pointer to a predicate
-// function to determine which characters are valid continuations.
-Node *Lexer::read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int (*pred)(int)) {
-  std::string lexeme(lexeme_start);
-  for (;;) {
-    int c = read();
-    int escaped = 0;
-
-    if (c == '\\') {
-      int c_next = read();
-      
-      switch(c_next) {
-        case 'n':
-          c = '\n';
-          break;
-        case 't':
-          c = '\t';
-          break;
-        case 'r':
-          c = '\r';
-          break;
-        case '"':
-          escaped=1;
-          c='"';
-          break;
-        
-      }
+// Scan a string literal (m_pos is just past the opening quotation
+// mark). The lexeme is the contents of the literal with escape
+// sequences translated. A string literal missing its closing
+// quotation mark ends at the end of the input.
+Node *Lexer::read_string(int line, int col) {
+  const char *start = m_pos, *p = m_pos;
+
+  // common case: no escapes, so the lexeme is a slice of the input
+  while (p != m_end && *p != '"' && *p != '\\') {
+    if (*p == '\n') {
+      m_line++;
+      m_line_start = p + 1;
     }
+    ++p;
+  }
+  if (p == m_end || *p == '"') {
+    m_pos = (p == m_end) ? p : p + 1;
+    return token_create(TOK_STRING, start, p, line, col);
+  }
 
-    if (c >= 0 && (escaped || pred(c))) {
-      // token has finished
-      lexeme.push_back(char(c));
-    } else {
-      if (c >= 0) {
-        unread(c);
+  std::string lexeme(start, p);
+  while (p != m_end && *p != '"') {
+    char c = *p++;
+    if (c == '\\' && p != m_end) {
+      // unknown escapes produce a backslash and drop the next character
+      char c_next = *p++;
+      switch (c_next) {
+      case 'n': c = '\n'; break;
+      case 't': c = '\t'; break;
+      case 'r': c = '\r'; break;
+      case '"': c = '"'; break;
+      }
+      if (c_next == '\n') {
+        m_line++;
+        m_line_start = p;
       }
-      return token_create(kind, lexeme, line, col);
+    } else if (c == '\n') {
+      m_line++;
+      m_line_start = p;
     }
+    lexeme.push_back(c);
   }
-}
+  m_pos = (p == m_end) ? p : p + 1;
 
-// implement additional member functions if necessary
+  return new Node(TOK_STRING, lexeme.data(), lexeme.size(), m_file_loc.at(line, col));
+}
 
-Node* Lexer::read_next_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int desired_next_c) {
+// Helper function to create a Node object to represent a token
+// whose lexeme is the input from start to end.
+Node *Lexer::token_create(enum TokenKind kind, const char *start, const char *end, int line, int col) {
+  return new Node(kind, start, size_t(end - start), m_file_loc.at(line, col));
+}
 
-  std::string lexeme(lexeme_start);
+void Lexer::raise_unrecognized(int c) {
+  SyntaxError::raise(get_current_loc(), "Unrecognized character '%c'", c);
+}
 
-  int c_next = read(); 
-  if (c_next < 0 || char(c_next) != desired_next_c) {
-    unread(c_next);
-    return nullptr;
+enum TokenKind Lexer::identifier_kind(const char *start, size_t len) {
+  // empty slots have length 0, which never matches an identifier
+  const Keyword &kw = s_keyword_table.slots[keyword_hash(len, *start)];
+  if (kw.len == len && memcmp(start, kw.text, len) == 0) {
+    return kw.kind;
   }
-
-  // if here, there was a valid token
-  lexeme.push_back(char(c_next));
-
-  return token_create(kind, lexeme, line, col);
+  return TOK_IDENTIFIER;
 }
-
@@ -5,17 +5,31 @@
 #include <cstdio>
 #include "token.h"
 #include "node.h"
+#include "input_buffer.h"
 
+// The Lexer reads the whole input in to memory up front (see
+// InputBuffer) and scans it with a pointer, so each token's lexeme
+// is copied straight from the input to its Node.
 class Lexer {
 private:
   FILE *m_in;
+  InputBuffer *m_input;
   std::deque<Node *> m_lookahead;
-  std::string m_filename;
-  int m_line, m_col;
+  Location m_file_loc;
+  const char *m_pos, *m_end;
+  // current line number, and where that line starts in the input
+  int m_line;
+  const char *m_line_start;
   bool m_eof;
 
+  // value semantics prohibited
+  Lexer(const Lexer &);
+  Lexer &operator=(const Lexer &);
+
 public:
   Lexer(FILE *in, const std::string &filename);
+  // lex input that has already been read
+  Lexer(InputBuffer *input_to_adopt, const std::string &filename);
   ~Lexer();
 
   // Consume the next token.
@@ -33,14 +47,12 @@ public:
   Location get_current_loc() const;
 
 private:
-  int read();
-  void unread(int c);
   void fill(int how_many);
   Node *read_token();
-  Node *token_create(enum TokenKind kind, const std::string &lexeme, int line, int col);
-  Node *read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int (*pred)(int));
-  Node *read_next_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int desired_next_c);
-  // TODO: add additional member functions if necessary
+  Node *read_string(int line, int col);
+  Node *token_create(enum TokenKind kind, const char *start, const char *end, int line, int col);
+  [[noreturn]] void raise_unrecognized(int c);
+  static enum TokenKind identifier_kind(const char *start, size_t len);
 };
 
 #endif // LEXER_H
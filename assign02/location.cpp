@@ -18,15 +18,24 @@
 // ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <mutex>
+#include <unordered_set>
 #include "location.h"
 
 Location::Location()
-  : m_srcfile("<unknown>")
-  , m_line(-1)
+  : m_line(-1)
   , m_col(-1) {
+  static const std::string *s_unknown = intern_srcfile("<unknown>");
+  m_srcfile = s_unknown;
 }
 
 Location::Location(const std::string &srcfile, int line, int col)
+  : m_srcfile(intern_srcfile(srcfile))
+  , m_line(line)
+  , m_col(col) {
+}
+
+Location::Location(const std::string *srcfile, int line, int col)
   : m_srcfile(srcfile)
   , m_line(line)
   , m_col(col) {
@@ -49,3 +58,13 @@ Location &Location::operator=(const Location &rhs) {
   }
   return *this;
 }
+
+// Interned names live until the program exits (there is one per
+// source file, so there aren't many of them)
+const std::string *Location::intern_srcfile(const std::string &srcfile) {
+  static std::mutex s_lock;
+  static std::unordered_set<std::string> s_names;
+
+  std::lock_guard<std::mutex> guard(s_lock);
+  return &*s_names.insert(srcfile).first;
+}
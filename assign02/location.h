@@ -25,7 +25,9 @@
 
 class Location {
 private:
-  std::string m_srcfile;
+  // source file names are interned, so copying a Location
+  // doesn't copy the name
+  const std::string *m_srcfile;
   int m_line, m_col;
 
 public:
@@ -36,15 +38,22 @@ public:
 
   Location &operator=(const Location &rhs);
 
+  // Return a Location in the same source file
+  Location at(int line, int col) const { return Location(m_srcfile, line, col); }
+
   bool is_valid() const { return m_line > 0; }
 
-  std::string get_srcfile() const { return m_srcfile; }
+  std::string get_srcfile() const { return *m_srcfile; }
   int get_line() const { return m_line; }
   int get_col() const { return m_col; }
 
   void advance(int num_cols) { m_col += num_cols; }
 
   void next_line() { m_line++; m_col = 1; }
+
+private:
+  Location(const std::string *srcfile, int line, int col);
+  static const std::string *intern_srcfile(const std::string &srcfile);
 };
 
 #endif // LOCATION_H
@@ -1,25 +1,196 @@
 #include <stdio.h>
 #include <unistd.h> // for getopt
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "cpputil.h"
 #include "lexer.h"
 #include "parser2.h"
 #include "ast.h"
+#include "ast_cache.h"
+#include "input_buffer.h"
 #include "exceptions.h"
 #include "treeprint.h"
 #include "interp.h"
+#include "bytecode.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "thread_pool.h"
 
 enum {
   PRINT_TOKENS,
   PRINT_AST,
+  PRINT_BYTECODE,
   EXECUTE,
 };
 
+void print_statistics(Interpreter &interp, unsigned num_removed) {
+  fprintf(stderr, "optimizer: %u AST nodes removed\n", num_removed);
+  fprintf(stderr, "quickening: %lu nodes quickened, %lu deoptimized\n",
+          interp.get_num_quickened(), interp.get_num_deoptimized());
+  interp.get_heap()->print_stats(stderr);
+}
+
+std::string format_error(const BaseException &ex) {
+  if (ex.has_location()) {
+    // the exception has Location information
+    const Location &loc = ex.get_loc();
+    return cpputil::format("%s:%d:%d: Error: %s\n", loc.get_srcfile().c_str(), loc.get_line(), loc.get_col(), ex.what());
+  }
+  // no Location
+  return cpputil::format("Error: %s\n", ex.what());
+}
+
+// Parse a source file (closing it). If there is a cache, the AST is
+// loaded from it when the source hasn't changed, and saved in it
+// otherwise.
+Node *parse_file(FILE *in, const char *filename, const ASTCache *cache) {
+  if (cache == nullptr) {
+    std::unique_ptr<Parser2> parser2(new Parser2(new Lexer(in, filename)));
+    return parser2->parse();
+  }
+
+  std::unique_ptr<InputBuffer> input;
+  try {
+    input.reset(new InputBuffer(in, filename));
+  } catch (...) {
+    fclose(in);
+    throw;
+  }
+  fclose(in);
+  uint64_t hash = ASTCache::hash_source(input->begin(), input->size());
+  size_t size = input->size();
+  Node *ast = cache->load(hash, size, filename);
+  if (ast == nullptr) {
+    std::unique_ptr<Parser2> parser2(new Parser2(new Lexer(input.release(), filename)));
+    ast = parser2->parse();
+    cache->store(hash, size, ast);
+  }
+  return ast;
+}
+
+// One script run by batch mode, and what happened when it was run
+struct BatchScript {
+  const char *filename;
+  std::mutex mutex;
+  std::condition_variable finished;
+  bool done;
+  // what the script printed (as well as its result), and its error
+  // message if it failed
+  std::string output, error;
+  double ms;
+
+  BatchScript(const char *name) : filename(name), done(false), ms(0.0) { }
+};
+
+// Parse, analyze and execute a script in its own isolated Interpreter
+void run_batch_script(BatchScript *script, ExecutionMode exec_mode, bool optimize, const ASTCache *cache,
+                      const Snapshot *snapshot) {
+  auto start = std::chrono::steady_clock::now();
+  std::string output, error;
+  try {
+    FILE *in = fopen(script->filename, "r");
+    if (!in) {
+      RuntimeError::raise("Could not open input file '%s'", script->filename);
+    }
+    Interpreter interp(parse_file(in, script->filename, cache));
+    interp.isolate();
+    interp.set_mode(exec_mode);
+    try {
+      if (snapshot != nullptr) {
+        interp.start_from(snapshot);
+      }
+      interp.analyze();
+      if (optimize) {
+        interp.optimize();
+      }
+      Value result = interp.execute();
+      output = interp.take_output();
+      output += cpputil::format("Result: %s\n", result.as_str().c_str());
+    } catch (BaseException &) {
+      // (what it printed before failing)
+      output = interp.take_output();
+      throw;
+    }
+  } catch (BaseException &ex) {
+    error = format_error(ex);
+  }
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::lock_guard<std::mutex> lock(script->mutex);
+  script->output = std::move(output);
+  script->error = std::move(error);
+  script->ms = elapsed.count();
+  script->done = true;
+  script->finished.notify_all();
+}
+
+// Run each script in its own Interpreter on the shared ThreadPool,
+// writing their output and errors in the order they were given (as
+// though each had been run on its own), then report how long each
+// took. Returns the number of scripts that failed.
+int run_batch(char **filenames, int num_files, ExecutionMode exec_mode, bool optimize, const ASTCache *cache,
+              const Snapshot *snapshot) {
+  auto start = std::chrono::steady_clock::now();
+  ThreadPool *pool = ThreadPool::get_shared();
+  std::vector<std::unique_ptr<BatchScript>> scripts;
+  for (int i = 0; i < num_files; i++) {
+    scripts.emplace_back(new BatchScript(filenames[i]));
+    BatchScript *script = scripts.back().get();
+    pool->submit([script, exec_mode, optimize, cache, snapshot] {
+      run_batch_script(script, exec_mode, optimize, cache, snapshot);
+    });
+  }
+
+  int num_failed = 0;
+  for (auto i = scripts.begin(); i != scripts.end(); ++i) {
+    BatchScript *script = i->get();
+    // run queued scripts on this thread too, until this one is done
+    std::unique_lock<std::mutex> lock(script->mutex);
+    while (!script->done) {
+      lock.unlock();
+      bool ran = pool->run_pending();
+      lock.lock();
+      if (!ran) {
+        script->finished.wait(lock, [script] { return script->done; });
+      }
+    }
+
+    fwrite(script->output.data(), 1, script->output.size(), stdout);
+    if (!script->error.empty()) {
+      fflush(stdout);
+      fputs(script->error.c_str(), stderr);
+      num_failed++;
+    }
+    std::string().swap(script->output);
+  }
+  fflush(stdout);
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+  fprintf(stderr, "Batch: %d scripts (%d failed) in %.3f ms on %u threads\n",
+          num_files, num_failed, elapsed.count(), pool->get_num_threads());
+  fprintf(stderr, "%10s  %s\n", "ms", "script");
+  for (auto i = scripts.begin(); i != scripts.end(); ++i) {
+    BatchScript *script = i->get();
+    fprintf(stderr, "%10.3f  %s%s\n", script->ms, script->filename, script->error.empty() ? "" : " (failed)");
+  }
+  return num_failed;
+}
+
 // The execute function orchestrates the overall program logic,
 // but could throw an exception if an error occurs
 int execute(int argc, char **argv) {
   // handle command line options
   int mode = EXECUTE, opt;
-  while ((opt = getopt(argc, argv, "lp")) != -1) {
+  ExecutionMode exec_mode = EXECUTE_BYTECODE;
+  bool optimize = true, print_stats = false, profile = false, batch = false;
+  const char *stacks_filename = nullptr, *save_filename = nullptr;
+  std::unique_ptr<ASTCache> cache;
+  std::unique_ptr<Snapshot> snapshot;
+  while ((opt = getopt(argc, argv, "lpdtnsPF:bc:S:R:")) != -1) {
     switch (opt) {
     case 'l':
       mode = PRINT_TOKENS;
@@ -27,11 +198,65 @@ int execute(int argc, char **argv) {
     case 'p':
       mode = PRINT_AST;
       break;
+    case 'd':
+      mode = PRINT_BYTECODE;
+      break;
+    case 't':
+      // use the tree-walking evaluator rather than the bytecode VM
+      exec_mode = EXECUTE_TREE_WALK;
+      break;
+    case 'n':
+      // don't optimize the AST
+      optimize = false;
+      break;
+    case 's':
+      // print statistics to stderr
+      print_stats = true;
+      break;
+    case 'P':
+      // profile execution, and print the hot spots when done
+      profile = true;
+      break;
+    case 'F':
+      // profile execution, and write collapsed call stacks to a file
+      profile = true;
+      stacks_filename = optarg;
+      break;
+    case 'b':
+      // run each of the (many) files given as a separate program
+      batch = true;
+      break;
+    case 'c':
+      // keep parsed ASTs in a cache directory
+      cache.reset(new ASTCache(optarg));
+      break;
+    case 'S':
+      // save the global environment in a snapshot file when done
+      save_filename = optarg;
+      break;
+    case 'R':
+      // start from the global environment saved in a snapshot file
+      snapshot.reset(new Snapshot(optarg));
+      break;
     default:
       RuntimeError::raise("Unknown option: %c", opt);
     }
   }
 
+  if (save_filename != nullptr && (mode != EXECUTE || batch || snapshot != nullptr)) {
+    RuntimeError::raise("A snapshot (-S) can only be saved by a program executed on its own");
+  }
+
+  if (batch) {
+    if (mode != EXECUTE || print_stats || profile) {
+      RuntimeError::raise("Batch mode (-b) can only be used with -t, -n, -c and -R");
+    }
+    if (optind >= argc) {
+      RuntimeError::raise("No input files given for batch mode");
+    }
+    return run_batch(argv + optind, argc - optind, exec_mode, optimize, cache.get(), snapshot.get()) > 0 ? 1 : 0;
+  }
+
   // determine source of input
 
   FILE *in;
@@ -49,11 +274,9 @@ int execute(int argc, char **argv) {
     in = stdin;
   }
 
-  // create the Lexer
-  std::unique_ptr<Lexer> lexer(new Lexer(in, filename));
-
   if (mode == PRINT_TOKENS) {
     // just print the tokens
+    std::unique_ptr<Lexer> lexer(new Lexer(in, filename));
     while (lexer->peek() != nullptr) {
       Node *tok = lexer->next();
       int kind = tok->get_tag();
@@ -61,22 +284,77 @@ int execute(int argc, char **argv) {
       printf("%d:%s\n", kind, lexeme.c_str());
       delete tok;
     }
-  } else if (mode == PRINT_AST || mode == EXECUTE) {
-    // Create parser and parse the input
-    std::unique_ptr<Parser2> parser2(new Parser2(lexer.release()));
-    std::unique_ptr<Node> ast(parser2->parse());
+  } else {
+    // Parse the input (or load the AST from the cache)
+    std::unique_ptr<Node> ast(parse_file(in, filename, cache.get()));
 
     if (mode == PRINT_AST) {
       // Print a text representation of the AST
       ASTTreePrint tp;
       tp.print(ast.get());
+    } else if (mode == PRINT_BYTECODE) {
+      // Print a listing of the compiled bytecode
+      Interpreter interp(ast.release());
+      if (snapshot != nullptr) {
+        interp.start_from(snapshot.get());
+      }
+      interp.analyze();
+      if (optimize) {
+        interp.optimize();
+      }
+      interp.compile();
+      interp.get_program()->disassemble();
     } else {
+      // a snapshot saves the AST as parsed
+      std::string parsed_ast;
+      if (save_filename != nullptr) {
+        parsed_ast = ASTCache::serialize(ast.get(), 0, 0);
+      }
+
       // Execute the program: note that the Interpreter assumes responsibility
       // for deleting the AST
       Interpreter interp(ast.release());
+      interp.set_mode(exec_mode);
+      if (profile) {
+        interp.enable_profiling();
+      }
+      if (snapshot != nullptr) {
+        interp.start_from(snapshot.get());
+      }
       interp.analyze();
-      Value result = interp.execute();
+      unsigned num_removed = optimize ? interp.optimize() : 0;
+      Value result;
+      try {
+        result = interp.execute();
+      } catch (BaseException &) {
+        // the statistics are still useful when the program fails
+        if (print_stats) {
+          print_statistics(interp, num_removed);
+        }
+        throw;
+      }
       printf("Result: %s\n", result.as_str().c_str());
+
+      if (save_filename != nullptr) {
+        interp.save_snapshot(save_filename, filename, parsed_ast);
+      }
+
+      if (print_stats) {
+        print_statistics(interp, num_removed);
+      }
+
+      if (profile) {
+        Profiler *profiler = interp.get_profiler();
+        profiler->print_report(stderr);
+        if (stacks_filename != nullptr) {
+          FILE *out = fopen(stacks_filename, "w");
+          if (!out) {
+            RuntimeError::raise("Could not open output file '%s'", stacks_filename);
+          }
+          profiler->write_collapsed_stacks(out);
+          fclose(out);
+        }
+      }
     }
   }
 
@@ -87,14 +365,7 @@ int main(int argc, char **argv) {
   try {
     return execute(argc, argv);
   } catch (BaseException &ex) {
-    if (ex.has_location()) {
-      // the exception has Location information
-      const Location &loc = ex.get_loc();
-      fprintf(stderr, "%s:%d:%d: Error: %s\n", loc.get_srcfile().c_str(), loc.get_line(), loc.get_col(), ex.what());
-    } else {
-      // no Location
-      fprintf(stderr, "Error: %s\n", ex.what());
-    }
+    fputs(format_error(ex).c_str(), stderr);
     return 1;
   }
 }
@@ -0,0 +1,184 @@
+#include <cassert>
+#include "string.h"
+#include "map.h"
+
+namespace {
+
+const size_t MIN_INDEX_SLOTS = 8;
+
+}
+
+Map::Map()
+  : ValRep(VALREP_MAP, sizeof(Map) + MIN_INDEX_SLOTS * sizeof(int32_t))
+  , m_index(MIN_INDEX_SLOTS, EMPTY)
+  , m_num_used(0)
+  , m_num_removed(0) {
+}
+
+Map::~Map() {
+}
+
+void Map::trace(Heap &heap) const {
+  for (auto i = m_entries.begin(); i != m_entries.end(); ++i) {
+    heap.mark_value(i->key);
+    heap.mark_value(i->val);
+  }
+}
+
+size_t Map::get_size() const {
+  return sizeof(Map) + m_entries.capacity() * sizeof(Entry) + m_index.capacity() * sizeof(int32_t);
+}
+
+const Value *Map::find(const Value &key) const {
+  int32_t *slot = const_cast<Map *>(this)->lookup(key, hash_key(key));
+  return *slot >= 0 ? &m_entries[*slot].val : nullptr;
+}
+
+void Map::put(const Value &key, const Value &val) {
+  uint32_t hash = hash_key(key);
+  int32_t *slot = lookup(key, hash);
+  if (*slot >= 0) {
+    m_entries[*slot].val = val;
+    return;
+  }
+
+  if (*slot == EMPTY && (m_num_used + 1) * 4 > m_index.size() * 3) {
+    // make room (dropping tombstones), then find the new slot
+    size_t num_slots = MIN_INDEX_SLOTS;
+    while (num_slots < 2 * (size_t(size()) + 1)) {
+      num_slots *= 2;
+    }
+    rebuild_index(num_slots);
+    slot = lookup(key, hash);
+  }
+
+  if (*slot == EMPTY) {
+    m_num_used++;
+  }
+  *slot = int32_t(m_entries.size());
+  Entry entry = { key, val, hash, false };
+  m_entries.push_back(entry);
+}
+
+bool Map::remove(const Value &key) {
+  int32_t *slot = lookup(key, hash_key(key));
+  if (*slot < 0) {
+    return false;
+  }
+
+  // the tombstone keeps later entries in the probe sequence reachable
+  Entry &entry = m_entries[*slot];
+  entry.key = Value();
+  entry.val = Value();
+  entry.removed = true;
+  *slot = TOMBSTONE;
+  m_num_removed++;
+
+  // drop the holes once they make up most of the entries
+  if (m_num_removed > 16 && m_num_removed * 2 > m_entries.size()) {
+    rebuild_index(m_index.size());
+  }
+  return true;
+}
+
+std::vector<Value> Map::get_keys() const {
+  std::vector<Value> keys;
+  keys.reserve(size_t(size()));
+  for (auto i = m_entries.begin(); i != m_entries.end(); ++i) {
+    if (!i->removed) {
+      keys.push_back(i->key);
+    }
+  }
+  return keys;
+}
+
+std::string Map::as_str() const {
+  std::string cur = "{";
+  bool first = true;
+  for (auto i = m_entries.begin(); i != m_entries.end(); ++i) {
+    if (i->removed) {
+      continue;
+    }
+    if (!first) {
+      cur += ", ";
+    }
+    first = false;
+    cur += i->key.as_str();
+    cur += ": ";
+    cur += i->val.as_str();
+  }
+  cur += "}";
+  return cur;
+}
+
+uint32_t Map::hash_key(const Value &key) {
+  assert(is_valid_key(key));
+  if (key.get_kind() == VALUE_STRING) {
+    return key.get_string()->hash();
+  }
+
+  // spread the bits of the int (the finalizer of MurmurHash3), so
+  // that runs of consecutive ints don't fill runs of slots
+  uint32_t h = uint32_t(key.get_ival());
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+bool Map::keys_equal(const Value &a, const Value &b) {
+  if (a.get_kind() == VALUE_STRING) {
+    return b.get_kind() == VALUE_STRING && a.get_string()->equals(b.get_string());
+  }
+  return Value::identical(a, b);
+}
+
+// Probe for key. If it isn't found, the slot returned is where it
+// should be added: the first tombstone passed, or the empty slot
+// that ended the search.
+int32_t *Map::lookup(const Value &key, uint32_t hash) {
+  size_t mask = m_index.size() - 1;
+  int32_t *tombstone = nullptr;
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    int32_t *slot = &m_index[i];
+    if (*slot == EMPTY) {
+      return tombstone != nullptr ? tombstone : slot;
+    }
+    if (*slot == TOMBSTONE) {
+      if (tombstone == nullptr) {
+        tombstone = slot;
+      }
+    } else {
+      const Entry &entry = m_entries[*slot];
+      if (entry.hash == hash && keys_equal(entry.key, key)) {
+        return slot;
+      }
+    }
+  }
+}
+
+// Compact the entries (dropping removed ones), and index them
+// in a table with num_slots slots
+void Map::rebuild_index(size_t num_slots) {
+  size_t num_live = 0;
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    if (!m_entries[i].removed) {
+      m_entries[num_live++] = m_entries[i];
+    }
+  }
+  m_entries.resize(num_live);
+  m_num_removed = 0;
+
+  m_index.assign(num_slots, EMPTY);
+  size_t mask = num_slots - 1;
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    size_t j = m_entries[i].hash & mask;
+    while (m_index[j] != EMPTY) {
+      j = (j + 1) & mask;
+    }
+    m_index[j] = int32_t(i);
+  }
+  m_num_used = unsigned(m_entries.size());
+}
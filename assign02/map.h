@@ -0,0 +1,82 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "valrep.h"
+#include "value.h"
+
+// A Map is a hash table from keys (ints or Strings) to values.
+// Entries are kept in insertion order, and found through an open
+// addressing (linear probing) index of entry numbers, so iterating
+// over the keys visits them in the order they were added. Removing
+// an entry leaves a hole in the entries and a tombstone in the index,
+// both of which go away the next time the index is rebuilt.
+class Map : public ValRep {
+private:
+  struct Entry {
+    Value key;
+    Value val;
+    uint32_t hash;
+    bool removed;
+  };
+
+  static constexpr int32_t EMPTY = -1;
+  static constexpr int32_t TOMBSTONE = -2;
+
+  std::vector<Entry> m_entries;
+  // size is a power of two, at most 3/4 of the slots are used
+  // (by entries or tombstones)
+  std::vector<int32_t> m_index;
+  unsigned m_num_used;      // index slots that aren't EMPTY
+  unsigned m_num_removed;   // removed entries
+
+  // value semantics prohibited
+  Map(const Map &);
+  Map &operator=(const Map &);
+
+public:
+  Map();
+  virtual ~Map();
+
+  virtual void trace(Heap &heap) const;
+  virtual size_t get_size() const;
+
+  // True if a value can be used as a key (an int or a string)
+  static bool is_valid_key(const Value &key) {
+    return key.get_kind() == VALUE_INT || key.get_kind() == VALUE_STRING;
+  }
+
+  // The functions taking a key require a valid key
+  int size() const { return int(m_entries.size() - m_num_removed); }
+  // the value for key, or null if there is none
+  const Value *find(const Value &key) const;
+  void put(const Value &key, const Value &val);
+  // returns false if there was no entry for key
+  bool remove(const Value &key);
+  // the keys, in the order they were added
+  std::vector<Value> get_keys() const;
+
+  // call fn(key, val) for each entry, in the order they were added
+  template<typename Fn>
+  void for_each(Fn fn) const {
+    for (auto i = m_entries.begin(); i != m_entries.end(); ++i) {
+      if (!i->removed) {
+        fn(i->key, i->val);
+      }
+    }
+  }
+
+  // the printed form of the map, e.g. "{a: 1, b: 2}"
+  std::string as_str() const;
+
+private:
+  static uint32_t hash_key(const Value &key);
+  static bool keys_equal(const Value &a, const Value &b);
+  // the index slot holding key's entry (or, if there is none, EMPTY)
+  int32_t *lookup(const Value &key, uint32_t hash);
+  void rebuild_index(size_t num_slots);
+};
+
+#endif // MAP_H
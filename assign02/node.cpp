@@ -60,6 +60,13 @@ Node::Node(int tag, const std::string &str)
   : Node(tag, str, {}) {
 }
 
+Node::Node(int tag, const char *str, size_t len, const Location &loc)
+  : m_tag(tag)
+  , m_str(str, len)
+  , m_loc(loc)
+  , m_loc_was_set_explicitly(true) {
+}
+
 Node::~Node() {
   // delete child nodes
   for (auto i = m_kids.begin(); i != m_kids.end(); ++i) {
@@ -86,3 +93,15 @@ void Node::prepend_kid(Node *kid) {
     m_loc = kid->get_loc();
   }
 }
+
+Node *Node::set_kid(unsigned index, Node *kid) {
+  Node *old = m_kids.at(index);
+  m_kids[index] = kid;
+  return old;
+}
+
+Node *Node::remove_kid(unsigned index) {
+  Node *old = m_kids.at(index);
+  m_kids.erase(m_kids.begin() + index);
+  return old;
+}
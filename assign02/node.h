@@ -54,6 +54,8 @@ public:
   Node(int tag, std::initializer_list<Node *> kids);
   Node(int tag, const std::vector<Node *> &kids);
   Node(int tag, const std::string &str);
+  // create a token from the len characters of its lexeme at str
+  Node(int tag, const char *str, size_t len, const Location &loc);
 
   virtual ~Node();
 
@@ -64,7 +66,13 @@ public:
   void set_str(const std::string &str) { m_str = str; }
 
   void append_kid(Node *kid);
+  // make room for a number of children (which are then appended)
+  void reserve_kids(unsigned num_kids) { m_kids.reserve(num_kids); }
   void prepend_kid(Node *kid);
+  // replace or remove a child: the old child is returned,
+  // and the caller becomes responsible for deleting it
+  Node *set_kid(unsigned index, Node *kid);
+  Node *remove_kid(unsigned index);
   unsigned get_num_kids() const { return unsigned(m_kids.size()); }
   Node *get_kid(unsigned index) const { return m_kids.at(index); }
   Node *get_last_kid() const { return m_kids.back(); }
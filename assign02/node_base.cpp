@@ -20,7 +20,14 @@
 
 #include "node_base.h"
 
-NodeBase::NodeBase() {
+NodeBase::NodeBase()
+  : m_depth(-1)
+  , m_slot(-1)
+  , m_num_slots(0)
+  , m_frame_escapes(true)
+  , m_intrinsic(nullptr)
+  , m_tail_call(false)
+  , m_deoptimized(false) {
 }
 
 NodeBase::~NodeBase() {
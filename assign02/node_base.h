@@ -21,13 +21,46 @@
 #ifndef NODE_BASE_H
 #define NODE_BASE_H
 
+#include <vector>
+#include "value.h"
+
 // The Node class will inherit from this type, so you can use it
 // to define any attributes and methods that Node objects should have
 // (constant value, results of semantic analysis, code generation info,
 // etc.)
 class NodeBase {
 private:
-  // fields could go here
+  // lexical address (scope depth and slot index) of a variable
+  // reference, set by Interpreter::analyze()
+  int m_depth, m_slot;
+
+  // number of variable slots in the scope introduced by this node
+  // (the unit, an if or while statement, or a function body)
+  int m_num_slots;
+
+  // true if a Function may capture the Environment for the scope
+  // introduced by this node (so it can't be allocated in the
+  // FrameArena), set by escape analysis in Interpreter::analyze()
+  bool m_frame_escapes;
+
+  // for a function body, the slots of the global variables it
+  // refers to (sorted), so that a task only needs copies of those
+  std::vector<int> m_global_refs;
+
+  // value of an integer or string literal, decoded once
+  // during analysis
+  Value m_literal;
+
+  // for a call to an intrinsic function that can be bound at
+  // analysis time, the intrinsic's registry entry
+  const Intrinsic *m_intrinsic;
+
+  // true for a call in tail position in a function body
+  bool m_tail_call;
+
+  // true if the node was quickened and then saw a non-int operand
+  // (so it stays generic)
+  bool m_deoptimized;
 
   // copy ctor and assignment operator not supported
   NodeBase(const NodeBase &);
@@ -36,6 +69,32 @@ private:
 public:
   NodeBase();
   virtual ~NodeBase();
+
+  void set_lexical_address(int depth, int slot) { m_depth = depth; m_slot = slot; }
+  bool has_lexical_address() const { return m_slot >= 0; }
+  int get_depth() const { return m_depth; }
+  int get_slot() const { return m_slot; }
+
+  void set_num_slots(int num_slots) { m_num_slots = num_slots; }
+  int get_num_slots() const { return m_num_slots; }
+
+  void set_frame_escapes(bool escapes) { m_frame_escapes = escapes; }
+  bool frame_escapes() const { return m_frame_escapes; }
+
+  void set_global_refs(const std::vector<int> &slots) { m_global_refs = slots; }
+  const std::vector<int> &get_global_refs() const { return m_global_refs; }
+
+  void set_literal(const Value &val) { m_literal = val; }
+  const Value &get_literal() const { return m_literal; }
+
+  void set_intrinsic(const Intrinsic *intrinsic) { m_intrinsic = intrinsic; }
+  const Intrinsic *get_intrinsic() const { return m_intrinsic; }
+
+  void set_tail_call(bool tail_call) { m_tail_call = tail_call; }
+  bool is_tail_call() const { return m_tail_call; }
+
+  void set_deoptimized() { m_deoptimized = true; }
+  bool is_deoptimized() const { return m_deoptimized; }
 };
 
 #endif // NODE_BASE_H
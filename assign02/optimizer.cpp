@@ -0,0 +1,198 @@
+#include <climits>
+#include <cstdint>
+#include <string>
+#include "ast.h"
+#include "node.h"
+#include "optimizer.h"
+
+namespace {
+
+unsigned count_nodes(Node *node) {
+  unsigned count = 0;
+  node->preorder([&count](Node *) { count++; });
+  return count;
+}
+
+}
+
+Optimizer::Optimizer()
+  : m_num_removed(0) {
+}
+
+Optimizer::~Optimizer() {
+}
+
+void Optimizer::optimize_unit(Node *unit) {
+  optimize_kids(unit);
+  remove_dead_statements(unit);
+}
+
+void Optimizer::optimize_kids(Node *node) {
+  for (unsigned i = 0; i < node->get_num_kids(); i++) {
+    Node *kid = node->get_kid(i);
+    Node *replacement = optimize_node(kid);
+    if (replacement != kid) {
+      discard(node->set_kid(i, replacement));
+      // the replacement is new
+      m_num_removed--;
+    }
+  }
+}
+
+// Optimize the subtree rooted at node, returning the node that should
+// replace it (node itself if it is kept). Nodes are optimized bottom
+// up, so a node's children are already as simple as they can be.
+Node *Optimizer::optimize_node(Node *node) {
+  optimize_kids(node);
+
+  switch (node->get_tag()) {
+  case AST_ADD:
+  case AST_SUB:
+  case AST_MULTIPLY:
+  case AST_DIVIDE:
+  case AST_LT:
+  case AST_LTE:
+  case AST_GT:
+  case AST_GTE:
+  case AST_EQ:
+  case AST_NOT_EQ:
+    return fold_binary(node);
+
+  case AST_LOGICAL_AND:
+  case AST_LOGICAL_OR:
+    return fold_logical(node);
+
+  case AST_IF:
+    return optimize_if(node);
+
+  case AST_WHILE:
+    return optimize_while(node);
+
+  case AST_STATEMENT_LIST:
+    remove_dead_statements(node);
+    return node;
+
+  default:
+    return node;
+  }
+}
+
+// Fold an arithmetic or comparison operation on two integer literals.
+// Operations that would fail at runtime are left alone.
+Node *Optimizer::fold_binary(Node *node) {
+  Node *lhs = node->get_kid(0), *rhs = node->get_kid(1);
+  if (!is_int_literal(lhs) || !is_int_literal(rhs)) {
+    return node;
+  }
+
+  int a = lhs->get_literal().get_ival(), b = rhs->get_literal().get_ival();
+  int result;
+  switch (node->get_tag()) {
+  // arithmetic wraps around, as it does at runtime
+  case AST_ADD:      result = int(uint32_t(a) + uint32_t(b)); break;
+  case AST_SUB:      result = int(uint32_t(a) - uint32_t(b)); break;
+  case AST_MULTIPLY: result = int(uint32_t(a) * uint32_t(b)); break;
+  case AST_DIVIDE:
+    if (b == 0 || (a == INT_MIN && b == -1)) {
+      return node;
+    }
+    result = a / b;
+    break;
+  case AST_LT:       result = a < b; break;
+  case AST_LTE:      result = a <= b; break;
+  case AST_GT:       result = a > b; break;
+  case AST_GTE:      result = a >= b; break;
+  case AST_EQ:       result = a == b; break;
+  default:           result = a != b; break;
+  }
+  return make_int_literal(result, node->get_loc());
+}
+
+// Fold a logical operator whose left operand is an integer literal
+// that short circuits it, or whose operands are both integer literals
+Node *Optimizer::fold_logical(Node *node) {
+  Node *lhs = node->get_kid(0), *rhs = node->get_kid(1);
+  if (!is_int_literal(lhs)) {
+    return node;
+  }
+
+  int a = lhs->get_literal().get_ival();
+  // note that || only short circuits if its left operand is exactly 1
+  if (node->get_tag() == AST_LOGICAL_AND ? a == 0 : a == 1) {
+    return make_int_literal(a, node->get_loc());
+  }
+  if (is_int_literal(rhs)) {
+    return make_int_literal(rhs->get_literal().get_ival() != 0, node->get_loc());
+  }
+  return node;
+}
+
+// Remove the arm of an if statement that can't be executed. An if
+// statement always evaluates to 0, so if neither arm can be executed
+// it is replaced by a literal 0.
+Node *Optimizer::optimize_if(Node *node) {
+  Node *condition = node->get_kid(0);
+  if (!is_int_literal(condition)) {
+    return node;
+  }
+
+  if (condition->get_literal().get_ival() != 0) {
+    if (node->get_num_kids() == 3) {
+      discard(node->remove_kid(2));
+    }
+    return node;
+  }
+
+  if (node->get_num_kids() == 2) {
+    return make_int_literal(0, node->get_loc());
+  }
+
+  // only the else arm is executed: it becomes the (only) arm of an
+  // if statement with a true condition, keeping the if statement's scope
+  Node *else_arm = node->remove_kid(2);
+  discard(node->set_kid(1, else_arm));
+  discard(node->set_kid(0, make_int_literal(1, condition->get_loc())));
+  m_num_removed--;
+  return node;
+}
+
+Node *Optimizer::optimize_while(Node *node) {
+  Node *condition = node->get_kid(0);
+  if (is_int_literal(condition) && condition->get_literal().get_ival() == 0) {
+    // the body is never executed, and a while loop evaluates to 0
+    return make_int_literal(0, node->get_loc());
+  }
+  return node;
+}
+
+// Remove statements consisting of a literal value from a statement
+// list, except for the last one (whose value is the value of the list)
+void Optimizer::remove_dead_statements(Node *list) {
+  unsigned i = 0;
+  while (i + 1 < list->get_num_kids()) {
+    Node *stmt = list->get_kid(i);
+    int tag = stmt->get_kid(0)->get_tag();
+    if (tag == AST_INT_LITERAL || tag == AST_STRING) {
+      discard(list->remove_kid(i));
+    } else {
+      i++;
+    }
+  }
+}
+
+Node *Optimizer::make_int_literal(int ival, const Location &loc) {
+  Node *literal = new Node(AST_INT_LITERAL, std::to_string(ival));
+  literal->set_loc(loc);
+  literal->set_literal(Value(ival));
+  return literal;
+}
+
+// Delete a subtree that has been removed from the AST
+void Optimizer::discard(Node *node) {
+  m_num_removed += count_nodes(node);
+  delete node;
+}
+
+bool Optimizer::is_int_literal(Node *node) {
+  return node->get_tag() == AST_INT_LITERAL;
+}
@@ -0,0 +1,44 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+class Node;
+class Location;
+
+// The Optimizer simplifies an analyzed AST without changing what
+// the program does (including which errors it reports, and where):
+// integer arithmetic and comparisons on literals are folded, dead
+// if arms and while (0) loops are removed, and statements that are
+// just a literal value are dropped when their value isn't used.
+class Optimizer {
+private:
+  unsigned m_num_removed;
+
+  // value semantics prohibited
+  Optimizer(const Optimizer &);
+  Optimizer &operator=(const Optimizer &);
+
+public:
+  Optimizer();
+  ~Optimizer();
+
+  // Optimize the unit in place
+  void optimize_unit(Node *unit);
+
+  // net number of AST nodes removed so far
+  unsigned get_num_removed() const { return m_num_removed; }
+
+private:
+  void optimize_kids(Node *node);
+  Node *optimize_node(Node *node);
+  Node *fold_binary(Node *node);
+  Node *fold_logical(Node *node);
+  Node *optimize_if(Node *node);
+  Node *optimize_while(Node *node);
+  void remove_dead_statements(Node *list);
+  Node *make_int_literal(int ival, const Location &loc);
+  void discard(Node *node);
+
+  static bool is_int_literal(Node *node);
+};
+
+#endif // OPTIMIZER_H
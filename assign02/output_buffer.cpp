@@ -0,0 +1,123 @@
+#include <cstring>
+#include "array.h"
+#include "map.h"
+#include "string.h"
+#include "value.h"
+#include "output_buffer.h"
+
+OutputBuffer::OutputBuffer(FILE *out)
+  : m_out(out)
+  , m_buf(new char[CAPACITY])
+  , m_len(0) {
+}
+
+OutputBuffer::OutputBuffer()
+  : OutputBuffer(nullptr) {
+}
+
+OutputBuffer::~OutputBuffer() {
+  flush();
+  delete[] m_buf;
+}
+
+void OutputBuffer::write(const char *data, size_t len) {
+  if (len > CAPACITY - m_len) {
+    flush();
+    if (len >= CAPACITY) {
+      // too big to be worth copying
+      if (m_out != nullptr) {
+        fwrite(data, 1, len, m_out);
+      } else {
+        m_kept.append(data, len);
+      }
+      return;
+    }
+  }
+  memcpy(m_buf + m_len, data, len);
+  m_len += len;
+}
+
+void OutputBuffer::write_int(int ival) {
+  // digits are generated backwards in to a scratch buffer
+  char digits[12];
+  char *p = digits + sizeof(digits);
+  unsigned magnitude = ival < 0 ? 0u - unsigned(ival) : unsigned(ival);
+  do {
+    *--p = char('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (ival < 0) {
+    *--p = '-';
+  }
+  write(p, size_t(digits + sizeof(digits) - p));
+}
+
+void OutputBuffer::write_value(const Value &val) {
+  switch (val.get_kind()) {
+  case VALUE_INT:
+    write_int(val.get_ival());
+    return;
+
+  case VALUE_STRING: {
+    String *str = val.get_string();
+    write(str->data(), size_t(str->len()));
+    return;
+  }
+
+  case VALUE_ARRAY: {
+    Array *arr = val.get_array();
+    put('[');
+    for (int i = 0; i < arr->len(); i++) {
+      if (i > 0) {
+        write(", ", 2);
+      }
+      write_value(arr->get_val(i));
+    }
+    put(']');
+    return;
+  }
+
+  case VALUE_MAP: {
+    bool first = true;
+    put('{');
+    val.get_map()->for_each([&](const Value &key, const Value &elt) {
+      if (!first) {
+        write(", ", 2);
+      }
+      first = false;
+      write_value(key);
+      write(": ", 2);
+      write_value(elt);
+    });
+    put('}');
+    return;
+  }
+
+  default: {
+    // functions aren't worth a special case
+    std::string text = val.as_str();
+    write(text.data(), text.size());
+    return;
+  }
+  }
+}
+
+void OutputBuffer::flush() {
+  if (m_out == nullptr) {
+    m_kept.append(m_buf, m_len);
+    m_len = 0;
+    return;
+  }
+  if (m_len > 0) {
+    fwrite(m_buf, 1, m_len, m_out);
+    m_len = 0;
+  }
+  fflush(m_out);
+}
+
+std::string OutputBuffer::take_output() {
+  flush();
+  std::string output;
+  output.swap(m_kept);
+  return output;
+}
@@ -0,0 +1,54 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+class Value;
+
+// An OutputBuffer collects the program's output, and writes it to
+// a FILE in large blocks (when the buffer is full, and when flush()
+// is called), or keeps all of it in memory. Values are formatted
+// straight in to the buffer.
+class OutputBuffer {
+private:
+  static const size_t CAPACITY = 64 * 1024;
+
+  FILE *m_out;
+  char *m_buf;
+  size_t m_len;
+  // the output so far, if it isn't written to a FILE
+  std::string m_kept;
+
+  // value semantics prohibited
+  OutputBuffer(const OutputBuffer &);
+  OutputBuffer &operator=(const OutputBuffer &);
+
+public:
+  OutputBuffer(FILE *out);
+  // keep the output (see take_output())
+  OutputBuffer();
+  // flushes the buffer
+  ~OutputBuffer();
+
+  void put(char c) {
+    if (m_len == CAPACITY) {
+      flush();
+    }
+    m_buf[m_len++] = c;
+  }
+  void write(const char *data, size_t len);
+  void write_int(int ival);
+  // write a value the way it is printed by print/println
+  void write_value(const Value &val);
+
+  bool is_empty() const { return m_len == 0; }
+  void flush();
+
+  // Keep the output from now on, rather than writing it
+  void keep() { flush(); m_out = nullptr; }
+  // Return (and forget) the output kept so far
+  std::string take_output();
+};
+
+#endif // OUTPUT_BUFFER_H
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <utility>
+#include "node.h"
+#include "ast.h"
+#include "function.h"
+#include "profiler.h"
+
+namespace {
+
+double to_ms(uint64_t ns) {
+  return double(ns) / 1000000.0;
+}
+
+double percent(uint64_t part, uint64_t whole) {
+  return whole > 0 ? 100.0 * double(part) / double(whole) : 0.0;
+}
+
+std::string format_loc(const Location &loc) {
+  return loc.get_srcfile() + ":" + std::to_string(loc.get_line()) + ":" + std::to_string(loc.get_col());
+}
+
+}
+
+Profiler::Profiler() {
+  m_root_stack.name = "<unit>";
+  m_root_stack.parent = nullptr;
+  m_root_stack.self_ns = 0;
+}
+
+Profiler::~Profiler() {
+  for (auto i = m_root_stack.children.begin(); i != m_root_stack.children.end(); ++i) {
+    delete_stack(i->second);
+  }
+}
+
+void Profiler::delete_stack(StackNode *stack) {
+  for (auto i = stack->children.begin(); i != stack->children.end(); ++i) {
+    delete_stack(i->second);
+  }
+  delete stack;
+}
+
+void Profiler::enter_node(Node *node) {
+  NodeStats &stats = m_node_stats[node];
+  stats.count++;
+  stats.active++;
+  NodeFrame frame = { &stats, Clock::now(), 0 };
+  m_node_frames.push_back(frame);
+}
+
+void Profiler::leave_node() {
+  NodeFrame frame = m_node_frames.back();
+  m_node_frames.pop_back();
+
+  uint64_t elapsed = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frame.start).count());
+  uint64_t self = elapsed > frame.child_ns ? elapsed - frame.child_ns : 0;
+  // (as for functions, a node in a recursive function would otherwise
+  // have its time counted once per activation)
+  if (--frame.stats->active == 0) {
+    frame.stats->total_ns += elapsed;
+  }
+  frame.stats->self_ns += self;
+  if (!m_node_frames.empty()) {
+    m_node_frames.back().child_ns += elapsed;
+  }
+
+  // the node's own time also belongs to the function (and call stack)
+  // it was evaluated in
+  if (m_function_frames.empty()) {
+    m_root_stack.self_ns += self;
+  } else {
+    m_function_frames.back().stats->self_ns += self;
+    m_function_frames.back().stack->self_ns += self;
+  }
+}
+
+void Profiler::enter_function(Function *fn) {
+  Node *body = fn->get_body();
+  auto i = m_function_stats.find(body);
+  if (i == m_function_stats.end()) {
+    FunctionStats stats = { fn->get_name(), body, 0, 0, 0, 0 };
+    i = m_function_stats.emplace(body, stats).first;
+  }
+  FunctionStats *stats = &i->second;
+  stats->calls++;
+  stats->active++;
+
+  StackNode *parent = m_function_frames.empty() ? &m_root_stack : m_function_frames.back().stack;
+  StackNode *&stack = parent->children[body];
+  if (stack == nullptr) {
+    stack = new StackNode();
+    stack->name = fn->get_name();
+    stack->parent = parent;
+    stack->self_ns = 0;
+  }
+
+  FunctionFrame frame = { stats, stack, Clock::now() };
+  m_function_frames.push_back(frame);
+}
+
+void Profiler::leave_function() {
+  FunctionFrame frame = m_function_frames.back();
+  m_function_frames.pop_back();
+
+  // only the outermost activation of a recursive function
+  // counts towards its total time
+  if (--frame.stats->active == 0) {
+    frame.stats->total_ns += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - frame.start).count());
+  }
+}
+
+void Profiler::print_report(FILE *out, unsigned num_rows) const {
+  ASTTreePrint tp;
+
+  uint64_t total_ns = 0;
+  std::vector<std::pair<Node *, const NodeStats *>> nodes;
+  for (auto i = m_node_stats.begin(); i != m_node_stats.end(); ++i) {
+    nodes.push_back(std::make_pair(i->first, &i->second));
+    total_ns += i->second.self_ns;
+  }
+  std::sort(nodes.begin(), nodes.end(), [](const std::pair<Node *, const NodeStats *> &a,
+                                           const std::pair<Node *, const NodeStats *> &b) {
+    return a.second->self_ns > b.second->self_ns;
+  });
+
+  fprintf(out, "Profile: %.3f ms evaluating %u distinct nodes\n\n", to_ms(total_ns), unsigned(nodes.size()));
+
+  fprintf(out, "Hot nodes:\n");
+  fprintf(out, "%10s %6s %10s %10s  %-14s %s\n", "self ms", "self%", "total ms", "count", "node", "location");
+  for (unsigned i = 0; i < nodes.size() && i < num_rows; i++) {
+    Node *node = nodes[i].first;
+    const NodeStats *stats = nodes[i].second;
+    fprintf(out, "%10.3f %6.2f %10.3f %10llu  %-14s %s\n",
+            to_ms(stats->self_ns), percent(stats->self_ns, total_ns), to_ms(stats->total_ns),
+            (unsigned long long) stats->count, tp.node_tag_to_string(node->get_tag()).c_str(),
+            format_loc(node->get_loc()).c_str());
+  }
+
+  // time per source line
+  std::map<std::pair<std::string, int>, std::pair<uint64_t, uint64_t>> lines;
+  for (auto i = nodes.begin(); i != nodes.end(); ++i) {
+    const Location &loc = i->first->get_loc();
+    auto &line = lines[std::make_pair(loc.get_srcfile(), loc.get_line())];
+    line.first += i->second->self_ns;
+    line.second += i->second->count;
+  }
+  std::vector<std::pair<std::pair<std::string, int>, std::pair<uint64_t, uint64_t>>> sorted_lines(lines.begin(), lines.end());
+  std::sort(sorted_lines.begin(), sorted_lines.end(), [](const decltype(sorted_lines)::value_type &a,
+                                                         const decltype(sorted_lines)::value_type &b) {
+    return a.second.first > b.second.first;
+  });
+
+  fprintf(out, "\nHot lines:\n");
+  fprintf(out, "%10s %6s %10s  %s\n", "self ms", "self%", "evals", "location");
+  for (unsigned i = 0; i < sorted_lines.size() && i < num_rows; i++) {
+    fprintf(out, "%10.3f %6.2f %10llu  %s:%d\n",
+            to_ms(sorted_lines[i].second.first), percent(sorted_lines[i].second.first, total_ns),
+            (unsigned long long) sorted_lines[i].second.second,
+            sorted_lines[i].first.first.c_str(), sorted_lines[i].first.second);
+  }
+
+  // time per function
+  std::vector<const FunctionStats *> functions;
+  for (auto i = m_function_stats.begin(); i != m_function_stats.end(); ++i) {
+    functions.push_back(&i->second);
+  }
+  std::sort(functions.begin(), functions.end(), [](const FunctionStats *a, const FunctionStats *b) {
+    return a->self_ns > b->self_ns;
+  });
+
+  fprintf(out, "\nFunctions:\n");
+  fprintf(out, "%10s %6s %10s %10s  %-14s %s\n", "self ms", "self%", "total ms", "calls", "function", "body at");
+  for (unsigned i = 0; i < functions.size() && i < num_rows; i++) {
+    const FunctionStats *stats = functions[i];
+    fprintf(out, "%10.3f %6.2f %10.3f %10llu  %-14s %s\n",
+            to_ms(stats->self_ns), percent(stats->self_ns, total_ns), to_ms(stats->total_ns),
+            (unsigned long long) stats->calls, stats->name.c_str(), format_loc(stats->def->get_loc()).c_str());
+  }
+}
+
+void Profiler::write_collapsed_stacks(FILE *out) const {
+  write_stack(out, &m_root_stack, "");
+}
+
+void Profiler::write_stack(FILE *out, const StackNode *stack, const std::string &prefix) const {
+  std::string name = prefix.empty() ? stack->name : prefix + ";" + stack->name;
+  uint64_t us = stack->self_ns / 1000;
+  if (us > 0) {
+    fprintf(out, "%s %llu\n", name.c_str(), (unsigned long long) us);
+  }
+  for (auto i = stack->children.begin(); i != stack->children.end(); ++i) {
+    write_stack(out, i->second, name);
+  }
+}
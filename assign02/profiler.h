@@ -0,0 +1,111 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+class Node;
+class Function;
+
+// The Profiler collects, for each AST node evaluated by the
+// tree-walking evaluator, the number of times it was evaluated and
+// the time spent in it (including and excluding the nodes below it).
+// Time is also attributed to user Functions and to the stack of
+// function calls active at the time, so that it can be written as
+// "collapsed stacks" for flame graph tools.
+class Profiler {
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct NodeStats {
+    uint64_t count;
+    uint64_t total_ns;   // including time spent in child nodes
+                         // (outermost activations only)
+    uint64_t self_ns;
+    int active;          // number of activations being evaluated
+  };
+
+  struct FunctionStats {
+    std::string name;
+    Node *def;           // body of the function (for its location)
+    uint64_t calls;
+    uint64_t total_ns;   // including callees (outermost activations only)
+    uint64_t self_ns;
+    int active;          // number of activations on the call stack
+  };
+
+  // A node in the tree of call stacks seen during execution
+  struct StackNode {
+    std::string name;
+    StackNode *parent;
+    uint64_t self_ns;
+    std::map<Node *, StackNode *> children;
+  };
+
+  struct NodeFrame {
+    NodeStats *stats;
+    Clock::time_point start;
+    uint64_t child_ns;
+  };
+
+  struct FunctionFrame {
+    FunctionStats *stats;
+    StackNode *stack;
+    Clock::time_point start;
+  };
+
+  std::unordered_map<Node *, NodeStats> m_node_stats;
+  std::map<Node *, FunctionStats> m_function_stats;
+  StackNode m_root_stack;
+  std::vector<NodeFrame> m_node_frames;
+  std::vector<FunctionFrame> m_function_frames;
+
+  // value semantics prohibited
+  Profiler(const Profiler &);
+  Profiler &operator=(const Profiler &);
+
+public:
+  Profiler();
+  ~Profiler();
+
+  void enter_node(Node *node);
+  void leave_node();
+  void enter_function(Function *fn);
+  void leave_function();
+
+  // Print tables of the hot spots (by node, by source line, and by
+  // function), limited to the num_rows most expensive entries each
+  void print_report(FILE *out, unsigned num_rows = 20) const;
+
+  // Write one line per distinct call stack: the function names
+  // separated by semicolons, and the time spent in microseconds
+  void write_collapsed_stacks(FILE *out) const;
+
+  // Records the evaluation of a node for as long as it is in scope
+  class NodeScope {
+  private:
+    Profiler *m_profiler;
+  public:
+    NodeScope(Profiler *profiler, Node *node) : m_profiler(profiler) { m_profiler->enter_node(node); }
+    ~NodeScope() { m_profiler->leave_node(); }
+  };
+
+  // Records a call to a user function for as long as it is in scope
+  class FunctionScope {
+  private:
+    Profiler *m_profiler;
+  public:
+    FunctionScope(Profiler *profiler, Function *fn) : m_profiler(profiler) { m_profiler->enter_function(fn); }
+    ~FunctionScope() { m_profiler->leave_function(); }
+  };
+
+private:
+  void write_stack(FILE *out, const StackNode *stack, const std::string &prefix) const;
+  static void delete_stack(StackNode *stack);
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,38 @@
+#include "scope.h"
+
+Scope::Scope(Scope *parent)
+  : m_parent(parent)
+  , m_captured(false)
+  , m_level(parent != nullptr ? parent->get_level() + 1 : 0) {
+}
+
+Scope::~Scope() {
+}
+
+int Scope::define_variable(const std::string &name) {
+  if (m_slots.count(name)) {
+    return 1;
+  }
+  int slot = int(m_slots.size());
+  m_slots.emplace(name, slot);
+  return 0;
+}
+
+bool Scope::lookup(const std::string &name, int &depth, int &slot) const {
+  depth = 0;
+  for (const Scope *scope = this; scope != nullptr; scope = scope->m_parent) {
+    auto i = scope->m_slots.find(name);
+    if (i != scope->m_slots.end()) {
+      slot = i->second;
+      return true;
+    }
+    depth++;
+  }
+  return false;
+}
+
+void Scope::mark_captured() {
+  for (Scope *scope = this; scope != nullptr && !scope->m_captured; scope = scope->m_parent) {
+    scope->m_captured = true;
+  }
+}
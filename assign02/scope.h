@@ -0,0 +1,48 @@
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <map>
+#include <string>
+
+// A Scope is the analysis-time counterpart of an Environment.
+// It maps each name defined in one lexical scope to the index
+// of the slot the name's value occupies in the runtime Environment.
+class Scope {
+private:
+  Scope *m_parent;
+  std::map<std::string, int> m_slots;
+  bool m_captured;
+  int m_level;
+
+  // copy constructor and assignment operator prohibited
+  Scope(const Scope &);
+  Scope &operator=(const Scope &);
+
+public:
+  Scope(Scope *parent = nullptr);
+  ~Scope();
+
+  Scope *get_parent() const { return m_parent; }
+
+  // number of scopes enclosing this one (0 for the global scope)
+  int get_level() const { return m_level; }
+
+  // Define a name in this scope, assigning it the next free slot.
+  // Returns 1 if the name was already defined in this scope.
+  int define_variable(const std::string &name);
+
+  // Find the lexical address of a name: depth is the number of
+  // scopes between this one and the one defining the name.
+  // Returns false if the name is not defined.
+  bool lookup(const std::string &name, int &depth, int &slot) const;
+
+  unsigned get_num_slots() const { return unsigned(m_slots.size()); }
+
+  // Escape analysis: a Function defined in a scope captures the
+  // Environment for that scope and (through its parent links) all
+  // of the enclosing ones, so they must outlive the scope itself
+  void mark_captured();
+  bool is_captured() const { return m_captured; }
+};
+
+#endif // SCOPE_H
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include "array.h"
+#include "ast.h"
+#include "ast_cache.h"
+#include "binary_io.h"
+#include "environment.h"
+#include "exceptions.h"
+#include "function.h"
+#include "input_buffer.h"
+#include "intrinsic.h"
+#include "map.h"
+#include "node.h"
+#include "string.h"
+#include "snapshot.h"
+
+namespace {
+
+// identifies the format (the last byte is the version)
+const char MAGIC[4] = { 'M', 'L', 'S', 1 };
+
+using binary_io::Reader;
+using binary_io::write_int;
+using binary_io::write_varint;
+
+}
+
+// Numbers the objects reachable from the global variables, and writes
+// values as their kind followed by an int, an intrinsic's index, or an
+// object's number
+class SnapshotWriter {
+private:
+  Environment *m_global_env;
+  const Intrinsic *m_intrinsics;
+  // the index of each function definition, by its body
+  std::unordered_map<const Node *, uint64_t> m_function_index;
+  std::unordered_map<const ValRep *, uint64_t> m_ids;
+
+public:
+  std::vector<Value> objects;
+
+  SnapshotWriter(Node *prelude, Environment *global_env, const Intrinsic *intrinsics)
+    : m_global_env(global_env)
+    , m_intrinsics(intrinsics) {
+    std::vector<Node *> functions = Snapshot::get_functions(prelude);
+    for (size_t i = 0; i < functions.size(); i++) {
+      m_function_index[functions[i]->get_last_kid()] = i;
+    }
+  }
+
+  // Give the value's object (if it has one) a number
+  void add(const Value &val) {
+    if (!val.is_dynamic() || m_ids.count(val.get_rep()) > 0) {
+      return;
+    }
+    switch (val.get_kind()) {
+    case VALUE_FILE:
+      RuntimeError::raise("A file can't be saved in a snapshot");
+    case VALUE_TASK:
+      RuntimeError::raise("A task can't be saved in a snapshot");
+    case VALUE_FUNCTION: {
+      // (a Function returned by a task refers to a copy of the
+      // global environment, which isn't saved)
+      const Function *fn = val.get_function();
+      if (fn->get_parent_env() != m_global_env || m_function_index.count(fn->get_body()) == 0) {
+        RuntimeError::raise("Function %s can't be saved in a snapshot", fn->get_name().c_str());
+      }
+      break;
+    }
+    default:
+      break;
+    }
+    m_ids.emplace(val.get_rep(), objects.size());
+    objects.push_back(val);
+  }
+
+  // Number the objects that a numbered object refers to
+  void add_contents(const Value &val) {
+    if (val.get_kind() == VALUE_ARRAY && !val.get_array()->is_packed()) {
+      const Array *arr = val.get_array();
+      for (int i = 0; i < arr->len(); i++) {
+        add(arr->get_val(i));
+      }
+    } else if (val.get_kind() == VALUE_MAP) {
+      val.get_map()->for_each([this](const Value &key, const Value &elt) {
+        add(key);
+        add(elt);
+      });
+    }
+  }
+
+  void write_object(std::string &out, const Value &val) {
+    write_varint(out, val.get_kind());
+    switch (val.get_kind()) {
+    case VALUE_STRING: {
+      const String *str = val.get_string();
+      write_varint(out, unsigned(str->len()));
+      out.append(str->data(), size_t(str->len()));
+      break;
+    }
+    case VALUE_ARRAY: {
+      // a packed array's ints are saved here, since they don't refer
+      // to any objects
+      const Array *arr = val.get_array();
+      write_varint(out, uint64_t(arr->len()) * 2 + (arr->is_packed() ? 1 : 0));
+      if (arr->is_packed()) {
+        for (int i = 0; i < arr->len(); i++) {
+          write_int(out, arr->get_val(i).get_ival());
+        }
+      }
+      break;
+    }
+    case VALUE_MAP:
+      write_varint(out, unsigned(val.get_map()->size()));
+      break;
+    case VALUE_FUNCTION:
+      write_varint(out, m_function_index[val.get_function()->get_body()]);
+      break;
+    default:
+      break;
+    }
+  }
+
+  void write_contents(std::string &out, const Value &val) {
+    if (val.get_kind() == VALUE_ARRAY && !val.get_array()->is_packed()) {
+      const Array *arr = val.get_array();
+      for (int i = 0; i < arr->len(); i++) {
+        write_value(out, arr->get_val(i));
+      }
+    } else if (val.get_kind() == VALUE_MAP) {
+      val.get_map()->for_each([this, &out](const Value &key, const Value &elt) {
+        write_value(out, key);
+        write_value(out, elt);
+      });
+    }
+  }
+
+  void write_value(std::string &out, const Value &val) {
+    write_varint(out, val.get_kind());
+    if (val.get_kind() == VALUE_INT) {
+      write_int(out, val.get_ival());
+    } else if (val.get_kind() == VALUE_INTRINSIC_FN) {
+      write_varint(out, uint64_t(val.get_intrinsic() - m_intrinsics));
+    } else {
+      write_varint(out, m_ids[val.get_rep()]);
+    }
+  }
+};
+
+Snapshot::Snapshot(const std::string &filename)
+  : m_filename(filename)
+  , m_num_intrinsics(0)
+  , m_ast(nullptr)
+  , m_ast_size(0)
+  , m_num_slots(0)
+  , m_values(nullptr)
+  , m_values_size(0) {
+  FILE *in = fopen(filename.c_str(), "rb");
+  if (!in) {
+    RuntimeError::raise("Could not open snapshot file '%s'", filename.c_str());
+  }
+  try {
+    m_input.reset(new InputBuffer(in, filename));
+  } catch (...) {
+    fclose(in);
+    throw;
+  }
+  fclose(in);
+
+  const char *data = m_input->begin();
+  size_t size = m_input->size();
+  if (size < sizeof(MAGIC) + 8 || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+    RuntimeError::raise("'%s' is not a snapshot file", filename.c_str());
+  }
+  if (!binary_io::has_valid_checksum(data, size)) {
+    raise_damaged();
+  }
+
+  Reader reader(data, size - 8);
+  reader.skip(sizeof(MAGIC));
+  m_num_intrinsics = unsigned(reader.read_varint());
+  m_prelude_filename = reader.read_bytes(reader.read_varint());
+  m_ast_size = size_t(reader.read_varint());
+  m_ast = reader.get_pos();
+  reader.skip(m_ast_size);
+  uint64_t num_slots = reader.read_varint();
+  if (!reader.ok() || num_slots > UINT_MAX) {
+    raise_damaged();
+  }
+  m_num_slots = unsigned(num_slots);
+  m_values = reader.get_pos();
+  m_values_size = size_t(data + size - 8 - m_values);
+}
+
+Snapshot::~Snapshot() {
+}
+
+Node *Snapshot::load_prelude() const {
+  // (the snapshot has its own checksum, and there is no source to
+  // compare the AST with)
+  Node *prelude = ASTCache::deserialize(m_ast, m_ast_size, 0, 0, m_prelude_filename);
+  if (prelude == nullptr) {
+    raise_damaged();
+  }
+  return prelude;
+}
+
+// The objects are created first, and the elements of the arrays and
+// maps are filled in once all of the objects they could refer to exist
+void Snapshot::restore(Environment *global_env, const std::vector<Function *> &functions,
+                       const Intrinsic *intrinsics, unsigned num_intrinsics) const {
+  Reader reader(m_values, m_values_size);
+  if (m_num_slots > global_env->get_num_slots() || num_intrinsics != m_num_intrinsics) {
+    raise_damaged();
+  }
+
+  std::vector<Value> objects(size_t(std::min<uint64_t>(reader.read_varint(), m_values_size)));
+  // the arrays (that aren't packed) and maps, with their sizes
+  std::vector<std::pair<Value, uint64_t>> pending;
+  for (auto i = objects.begin(); i != objects.end() && reader.ok(); ++i) {
+    uint64_t kind = reader.read_varint();
+    uint64_t n = reader.read_varint();
+    switch (kind) {
+    case VALUE_STRING:
+      *i = Value(new String(reader.read_bytes(n)));
+      break;
+    case VALUE_ARRAY:
+      // (each element takes at least one byte)
+      if (n / 2 > m_values_size) {
+        raise_damaged();
+      }
+      if (n % 2 == 1) {
+        std::vector<int32_t> ints(size_t(n / 2));
+        for (auto j = ints.begin(); j != ints.end(); ++j) {
+          *j = int32_t(reader.read_int());
+        }
+        *i = Value(new Array(std::move(ints)));
+      } else {
+        *i = Value(new Array(std::vector<Value>(size_t(n / 2))));
+        pending.emplace_back(*i, n / 2);
+      }
+      break;
+    case VALUE_MAP:
+      *i = Value(new Map());
+      pending.emplace_back(*i, n);
+      break;
+    case VALUE_FUNCTION:
+      if (n >= functions.size()) {
+        raise_damaged();
+      }
+      *i = Value(functions[n]);
+      break;
+    default:
+      raise_damaged();
+    }
+  }
+
+  auto read_value = [&]() {
+    uint64_t kind = reader.read_varint();
+    if (kind == VALUE_INT) {
+      return Value(int(reader.read_int()));
+    }
+    uint64_t n = reader.read_varint();
+    if (kind == VALUE_INTRINSIC_FN && n < num_intrinsics) {
+      return Value(&intrinsics[n]);
+    }
+    if (n >= objects.size() || objects[n].get_kind() != kind) {
+      raise_damaged();
+    }
+    return objects[n];
+  };
+
+  for (auto i = pending.begin(); i != pending.end() && reader.ok(); ++i) {
+    if (i->first.get_kind() == VALUE_ARRAY) {
+      Array *arr = i->first.get_array();
+      for (int j = 0; j < arr->len(); j++) {
+        arr->set_val(read_value(), j);
+      }
+    } else {
+      Map *map = i->first.get_map();
+      for (uint64_t j = 0; j < i->second && reader.ok(); j++) {
+        Value key = read_value();
+        if (!Map::is_valid_key(key)) {
+          raise_damaged();
+        }
+        map->put(key, read_value());
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < m_num_slots && reader.ok(); i++) {
+    global_env->get_slot(i) = read_value();
+  }
+  if (!reader.ok() || !reader.at_end()) {
+    raise_damaged();
+  }
+}
+
+void Snapshot::write(const std::string &filename, const std::string &prelude_filename,
+                     const std::string &parsed_ast, Node *prelude, Environment *global_env,
+                     const Intrinsic *intrinsics, unsigned num_intrinsics) {
+  SnapshotWriter writer(prelude, global_env, intrinsics);
+  unsigned num_slots = global_env->get_num_slots();
+  for (unsigned i = 0; i < num_slots; i++) {
+    writer.add(global_env->get_slot(i));
+  }
+  // (this numbers more objects as it goes)
+  for (size_t i = 0; i < writer.objects.size(); i++) {
+    writer.add_contents(writer.objects[i]);
+  }
+
+  std::string out(MAGIC, sizeof(MAGIC));
+  write_varint(out, num_intrinsics);
+  write_varint(out, prelude_filename.size());
+  out += prelude_filename;
+  write_varint(out, parsed_ast.size());
+  out += parsed_ast;
+  write_varint(out, num_slots);
+
+  write_varint(out, writer.objects.size());
+  for (auto i = writer.objects.begin(); i != writer.objects.end(); ++i) {
+    writer.write_object(out, *i);
+  }
+  for (auto i = writer.objects.begin(); i != writer.objects.end(); ++i) {
+    writer.write_contents(out, *i);
+  }
+  for (unsigned i = 0; i < num_slots; i++) {
+    writer.write_value(out, global_env->get_slot(i));
+  }
+  binary_io::write_checksum(out);
+
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (!f) {
+    RuntimeError::raise("Could not open snapshot file '%s'", filename.c_str());
+  }
+  bool written = fwrite(out.data(), 1, out.size(), f) == out.size();
+  if (fclose(f) != 0 || !written) {
+    RuntimeError::raise("Could not write snapshot file '%s'", filename.c_str());
+  }
+}
+
+std::vector<Node *> Snapshot::get_functions(Node *unit) {
+  // (functions can only be defined at the top level)
+  std::vector<Node *> functions;
+  unit->each_child([&functions](Node *node) {
+    if (node->get_tag() == AST_FUNC) {
+      functions.push_back(node);
+    }
+  });
+  return functions;
+}
+
+void Snapshot::raise_damaged() const {
+  RuntimeError::raise("Snapshot file '%s' is damaged", m_filename.c_str());
+}
@@ -0,0 +1,79 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+class Node;
+class Environment;
+class Function;
+class InputBuffer;
+struct Intrinsic;
+
+// A Snapshot is the state a program (the "prelude") left the global
+// environment in, saved in a file: the prelude's AST as it was parsed,
+// and the values of its global variables, along with the Strings,
+// Arrays, Maps and Functions they refer to. A later program can start
+// from the snapshot rather than running the prelude again (see
+// Interpreter::start_from()).
+//
+// The values are saved as a table of objects (in the order they were
+// first reached, with shared objects and cycles saved once): the kind
+// of each object, and its text, packed ints, size, or (for a
+// Function) which of the prelude's function definitions it is, then
+// the elements of the arrays and maps (which refer to objects by
+// their position in the table), then the global variables.
+class Snapshot {
+private:
+  std::string m_filename;
+  std::unique_ptr<InputBuffer> m_input;
+  unsigned m_num_intrinsics;
+  std::string m_prelude_filename;
+  // the prelude's AST (see ASTCache::serialize())
+  const char *m_ast;
+  size_t m_ast_size;
+  unsigned m_num_slots;
+  // the objects and the global variables
+  const char *m_values;
+  size_t m_values_size;
+
+  // value semantics prohibited
+  Snapshot(const Snapshot &);
+  Snapshot &operator=(const Snapshot &);
+
+public:
+  // Read a snapshot file (raising a RuntimeError if it isn't one)
+  Snapshot(const std::string &filename);
+  ~Snapshot();
+
+  const std::string &get_filename() const { return m_filename; }
+  // the number of intrinsics of the interpreter that saved it
+  unsigned get_num_intrinsics() const { return m_num_intrinsics; }
+
+  // A new copy of the prelude's AST, as it was parsed
+  Node *load_prelude() const;
+
+  // Set the prelude's global variables in global_env (which is in
+  // the current heap) to their saved values. functions are Functions
+  // for the prelude's function definitions (see get_functions()).
+  // Raises a RuntimeError if the snapshot is damaged.
+  void restore(Environment *global_env, const std::vector<Function *> &functions,
+               const Intrinsic *intrinsics, unsigned num_intrinsics) const;
+
+  // Save a snapshot of the global environment of a prelude which has
+  // finished running. parsed_ast is ASTCache::serialize() of the
+  // prelude as parsed, and prelude is the (analyzed) AST that ran.
+  // Raises a RuntimeError if a variable refers to something that
+  // can't be saved (a file or a task), or the file can't be written.
+  static void write(const std::string &filename, const std::string &prelude_filename,
+                    const std::string &parsed_ast, Node *prelude, Environment *global_env,
+                    const Intrinsic *intrinsics, unsigned num_intrinsics);
+
+  // The function definitions of a unit, in order
+  static std::vector<Node *> get_functions(Node *unit);
+
+private:
+  void raise_damaged() const;
+};
+
+#endif // SNAPSHOT_H
@@ -1,22 +1,142 @@
-
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include "input_buffer.h"
 #include "string.h"
 #include "valrep.h"
 
 String::String(std::string text)
-  : ValRep(VALREP_STRING),
-  text(text) {
+  : ValRep(VALREP_STRING, sizeof(String) + sizeof(Buffer) + text.size())
+  , m_buf(new Buffer(std::move(text)))
+  , m_start(0)
+  , m_len(unsigned(m_buf->text.size()))
+  , m_hash(0) {
+
+}
+
+String::Buffer::Buffer(InputBuffer *in)
+  : refcount(1)
+  , gc_epoch(0)
+  , shared(true)
+  , input(in)
+  , chars(in->begin()) {
+}
+
+String::Buffer::~Buffer() {
+  delete input;
+}
+
+// A mapped file isn't part of the heap, so only the buffer's
+// own memory is counted
+size_t String::Buffer::get_num_bytes() const {
+  if (input != nullptr) {
+    return sizeof(Buffer) + (input->is_mapped() ? 0 : input->size());
+  }
+  return sizeof(Buffer) + text.capacity();
+}
+
+String::String(InputBuffer *input_to_adopt)
+  : ValRep(VALREP_STRING, sizeof(String) + sizeof(Buffer) +
+                          (input_to_adopt->is_mapped() ? 0 : input_to_adopt->size()))
+  , m_buf(new Buffer(input_to_adopt))
+  , m_start(0)
+  , m_len(unsigned(input_to_adopt->size()))
+  , m_hash(0) {
+}
 
+String::String(Buffer *buf, unsigned start, unsigned len)
+  : ValRep(VALREP_STRING, sizeof(String))
+  , m_buf(buf)
+  , m_start(start)
+  , m_len(len)
+  , m_hash(0) {
+  m_buf->add_ref();
 }
 
 String::~String() {
+  if (m_buf->release()) {
+    delete m_buf;
+  }
+}
 
+// Strings don't refer to other objects, but the buffer is counted
+// towards the size of the heap (once, however many views share it,
+// unless other heaps may be using it too)
+void String::trace(Heap &heap) const {
+  if (!m_buf->shared) {
+    heap.claim(m_buf->gc_epoch, m_buf->get_num_bytes());
+  }
 }
 
-std::string String::substr(int ind_1, int size) {
+String *String::substr(int ind, int size) const {
+
+  if (ind + size > len()) {
+    return new String("");
+  }
 
-  if (ind_1 + size > len()) {
-    return "";
+  if (ind < 0 || size < 0) {
+    // keep std::string's behavior for out of range arguments
+    return new String(get_text().substr(ind, size));
   }
 
-  return text.substr(ind_1, size);
-}
\ No newline at end of file
+  return new String(m_buf, m_start + unsigned(ind), unsigned(size));
+}
+
+String *String::view(unsigned ind, unsigned size) const {
+  assert(ind <= m_len && size <= m_len - ind);
+  return new String(m_buf, m_start + ind, size);
+}
+
+String *String::copy() const {
+  if (m_buf->shared) {
+    return new String(m_buf, m_start, m_len);
+  }
+  return new String(get_text());
+}
+
+void String::freeze() {
+  hash();
+  m_buf->shared = true;
+}
+
+int String::compare(const String *other) const {
+  unsigned n = std::min(m_len, other->m_len);
+  int cmp = n > 0 ? memcmp(data(), other->data(), n) : 0;
+  if (cmp != 0) {
+    return cmp;
+  }
+  return m_len < other->m_len ? -1 : (m_len > other->m_len ? 1 : 0);
+}
+
+// FNV-1a
+uint32_t String::compute_hash() const {
+  uint32_t h = 2166136261u;
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data());
+  for (unsigned i = 0; i < m_len; i++) {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h != 0 ? h : 1;
+}
+
+String *String::append(const String *other) const {
+  if (!m_buf->shared && m_start + m_len == m_buf->text.size()) {
+    // nothing in the buffer follows this string, so other can
+    // be appended in place (note that other may be a view of the
+    // same buffer, so its characters are copied first)
+    if (other->m_buf == m_buf) {
+      std::string tail = other->get_text();
+      m_buf->text.append(tail);
+    } else {
+      m_buf->text.append(other->data(), other->m_len);
+    }
+    m_buf->chars = m_buf->text.data();
+    return new String(m_buf, m_start, m_len + other->m_len);
+  }
+
+  std::string text;
+  text.reserve(m_len + other->m_len);
+  text.append(data(), m_len);
+  text.append(other->data(), other->m_len);
+  return new String(std::move(text));
+}
@@ -1,13 +1,72 @@
 #ifndef STRING_H
 #define STRING_H
 
+#include <atomic>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include "valrep.h"
+class InputBuffer;
 
+// A String is a view (start, length) of a character buffer that
+// may be shared by many Strings. substr() returns a view of the same
+// buffer, and append() extends the buffer in place when the String
+// being appended to ends at the end of the buffer, which is always
+// the case when a string is built up by repeated strcat calls. Bytes
+// past the end of a view are never visible through it, so other views
+// of the same buffer are unaffected by an in-place append. A buffer
+// can also be the contents of a file (see File).
+//
+// A buffer is "shared" if Strings on other threads may use it (the
+// buffers of interned literals and of files): a shared buffer is
+// never appended to in place, and isn't counted by the GC.
 class String : public ValRep {
 private:
-  std::string text;
+  struct Buffer {
+    std::atomic<int> refcount;
+    unsigned gc_epoch;  // see Heap::claim()
+    bool shared;
+    std::string text;
+    // the file contents, if this is a file's buffer
+    InputBuffer *input;
+    // the characters (of text, or of input)
+    const char *chars;
+
+    Buffer(std::string &&t)
+      : refcount(1), gc_epoch(0), shared(false), text(std::move(t)), input(nullptr), chars(text.data()) { }
+    Buffer(InputBuffer *in);
+    ~Buffer();
+
+    // bytes of memory used
+    size_t get_num_bytes() const;
+
+    // Only a shared buffer's count can change on more than one
+    // thread, so only it pays for atomic updates
+    void add_ref() {
+      if (shared) {
+        refcount.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        refcount.store(refcount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+    }
+    // returns true if that was the last reference
+    bool release() {
+      if (shared) {
+        return refcount.fetch_sub(1, std::memory_order_acq_rel) == 1;
+      }
+      int count = refcount.load(std::memory_order_relaxed) - 1;
+      refcount.store(count, std::memory_order_relaxed);
+      return count == 0;
+    }
+  };
+
+  Buffer *m_buf;
+  unsigned m_start, m_len;
+  // hash of the characters (computed the first time it is needed,
+  // 0 until then)
+  mutable uint32_t m_hash;
+
+  String(Buffer *buf, unsigned start, unsigned len);
 
   // value semantics prohibited
   String(const String &);
@@ -15,13 +74,58 @@ private:
 
 public:
   String(std::string text);
+  // A String of all of input (which the String's buffer adopts).
+  // Views of it are made with view().
+  String(InputBuffer *input_to_adopt);
   virtual ~String();
 
-  std::string get_text() const { return text; }
+  virtual void trace(Heap &heap) const;
+  virtual size_t get_size() const { return sizeof(String); }
+
+  std::string get_text() const { return std::string(data(), m_len); }
+  const char *data() const { return m_buf->chars + m_start; }
+
+  int len() const { return int(m_len); }
 
-  int len() { return text.size(); }
+  // Return the substring of len characters starting at ind
+  // (an empty string if it would extend past the end)
+  String *substr(int ind, int len) const;
 
-  std::string substr(int ind_1, int ind_2);
+  // Return the substring of len characters starting at ind, which
+  // must be within the string
+  String *view(unsigned ind, unsigned len) const;
+
+  // Return a String with the same characters, for use on another
+  // thread (a view of the same buffer if it is shared, otherwise
+  // a copy)
+  String *copy() const;
+
+  // Let Strings on other threads use this String's buffer (see
+  // Heap::pin() for sharing the String itself). The String's hash
+  // is computed now, since it can't be cached later.
+  void freeze();
+
+  // Return the concatenation of this string and other
+  String *append(const String *other) const;
+
+  // Compare the characters of this string and other (like strcmp)
+  int compare(const String *other) const;
+  bool equals(const String *other) const {
+    return m_len == other->m_len &&
+           ((m_buf == other->m_buf && m_start == other->m_start) || compare(other) == 0);
+  }
+
+  // Hash of the characters (never 0), cached on the String since
+  // a String's characters never change
+  uint32_t hash() const {
+    if (m_hash == 0) {
+      m_hash = compute_hash();
+    }
+    return m_hash;
+  }
+
+private:
+  uint32_t compute_hash() const;
 };
 
 #endif // STRING_H
@@ -0,0 +1,94 @@
+#include <cassert>
+#include "interp.h"
+#include "value_copier.h"
+#include "task.h"
+
+Task::Task(const std::shared_ptr<State> &state)
+  : ValRep(VALREP_TASK, sizeof(Task) + state->get_num_bytes())
+  , m_state(state) {
+}
+
+Task::~Task() {
+}
+
+size_t Task::get_size() const {
+  return sizeof(Task) + m_state->get_num_bytes();
+}
+
+Task::State::State(Interpreter *interp, const Value &fn, std::vector<Value> &&args, const Location &loc)
+  : m_interp(interp)
+  , m_fn(fn)
+  , m_args(std::move(args))
+  , m_loc(loc)
+  , m_num_bytes(sizeof(State) + sizeof(Interpreter) + interp->get_heap()->get_num_bytes())
+  , m_started(false)
+  , m_done(false)
+  , m_output_taken(false) {
+}
+
+Task::State::~State() {
+}
+
+void Task::State::run() {
+  if (!start()) {
+    return;
+  }
+  try {
+    m_result = m_interp->run_task(m_fn, m_args, m_loc);
+  } catch (...) {
+    m_error = std::current_exception();
+  }
+  std::string output = m_interp->take_output();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_output = std::move(output);
+  m_done = true;
+  m_finished.notify_all();
+}
+
+bool Task::State::is_done() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_done;
+}
+
+bool Task::State::is_finished_with() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_done && m_output_taken;
+}
+
+bool Task::State::start() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  bool started = m_started;
+  m_started = true;
+  return !started;
+}
+
+// Only this task is run while waiting, not other queued jobs: a job
+// run here could wait for a task that is further down this thread's
+// stack (such as one joining the task being waited for), which could
+// then never finish. The job left in the pool does nothing.
+void Task::State::wait() {
+  run();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_finished.wait(lock, [this] { return m_done; });
+}
+
+std::string Task::State::take_output() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  assert(m_done);
+  std::string output;
+  if (!m_output_taken) {
+    output.swap(m_output);
+    m_output_taken = true;
+  }
+  return output;
+}
+
+Value Task::State::get_result() {
+  assert(is_done());
+  if (m_error) {
+    std::rethrow_exception(m_error);
+  }
+  ValueCopier copier;
+  return copier.copy(m_result);
+}
@@ -0,0 +1,105 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "location.h"
+#include "valrep.h"
+#include "value.h"
+class Interpreter;
+
+// A Task is a function call started by the spawn intrinsic, which
+// runs on the shared ThreadPool. Each task has its own Interpreter
+// (with its own heap), and the function and arguments are copied in
+// to that heap before the task starts, so tasks share nothing with
+// the program that spawned them (other than immutable things: the
+// AST, the bytecode, pinned literals and file contents). The join
+// intrinsic waits for a task, and copies its result back.
+class Task : public ValRep {
+public:
+  class State;
+
+private:
+  // shared by every Task value (in any heap) for the same task,
+  // and by the job running it
+  std::shared_ptr<State> m_state;
+
+  // value semantics prohibited
+  Task(const Task &);
+  Task &operator=(const Task &);
+
+public:
+  Task(const std::shared_ptr<State> &state);
+  virtual ~Task();
+
+  virtual void trace(Heap &heap) const { }
+  // includes the task's memory, so that tasks which are no longer
+  // used are collected in good time
+  virtual size_t get_size() const;
+
+  State *get_state() const { return m_state.get(); }
+
+  // A Task for the same task (which can be used on another thread)
+  Task *copy() const { return new Task(m_state); }
+};
+
+class Task::State {
+private:
+  // owns the function, the arguments and the result
+  std::unique_ptr<Interpreter> m_interp;
+  Value m_fn;
+  std::vector<Value> m_args;
+  Location m_loc;
+  // roughly the memory used by the task's interpreter
+  size_t m_num_bytes;
+
+  std::mutex m_mutex;
+  std::condition_variable m_finished;
+  // set by the thread that runs the task (a worker, or a thread
+  // waiting for the task before a worker got to it)
+  bool m_started;
+  bool m_done;
+  bool m_output_taken;
+  Value m_result;
+  std::exception_ptr m_error;
+  std::string m_output;
+
+  // value semantics prohibited
+  State(const State &);
+  State &operator=(const State &);
+
+  // returns false if the task has already been started
+  bool start();
+
+public:
+  // fn and args must be in interp's heap
+  State(Interpreter *interp, const Value &fn, std::vector<Value> &&args, const Location &loc);
+  ~State();
+
+  size_t get_num_bytes() const { return m_num_bytes; }
+
+  // Call the function, unless another thread already has
+  void run();
+
+  bool is_done();
+  // True once the task is done and its output has been taken
+  bool is_finished_with();
+
+  // Wait for the task to finish, running it on this thread if
+  // it hasn't been started yet
+  void wait();
+
+  // The output the task printed, the first time this is called
+  // after it finishes (and "" after that)
+  std::string take_output();
+
+  // The task's result, copied in to the current heap. Raises the
+  // error that the task failed with, if it failed.
+  Value get_result();
+};
+
+#endif // TASK_H
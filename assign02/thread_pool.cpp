@@ -0,0 +1,113 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+namespace {
+
+// the pool the current thread is a worker of (if any), and its index
+thread_local const ThreadPool *t_pool = nullptr;
+thread_local int t_worker_index = -1;
+
+}
+
+ThreadPool::ThreadPool(unsigned num_threads)
+  : m_num_queued(0)
+  , m_next_queue(0)
+  , m_stopping(false) {
+  for (unsigned i = 0; i < std::max(num_threads, 1u); i++) {
+    m_workers.emplace_back(new Worker());
+  }
+  for (unsigned i = 0; i < m_workers.size(); i++) {
+    m_workers[i]->thread = std::thread(&ThreadPool::worker_loop, this, int(i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_work_available.notify_all();
+  for (auto i = m_workers.begin(); i != m_workers.end(); ++i) {
+    (*i)->thread.join();
+  }
+}
+
+ThreadPool *ThreadPool::get_shared() {
+  static ThreadPool s_pool(std::thread::hardware_concurrency());
+  return &s_pool;
+}
+
+void ThreadPool::submit(Job job) {
+  int index = get_worker_index();
+  if (index < 0) {
+    index = int(m_next_queue++ % m_workers.size());
+  }
+  // (counted first, so that the count can't drop below 0 if
+  // the job is taken right away)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_num_queued++;
+  }
+  Worker *worker = m_workers[index].get();
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->jobs.push_back(std::move(job));
+  }
+  m_work_available.notify_one();
+}
+
+bool ThreadPool::run_pending() {
+  Job job;
+  if (!take_job(get_worker_index(), job)) {
+    return false;
+  }
+  job();
+  return true;
+}
+
+int ThreadPool::get_worker_index() const {
+  return t_pool == this ? t_worker_index : -1;
+}
+
+// Take the newest job from worker index's own queue, or else the
+// oldest job from another queue (index is -1 for a thread that
+// isn't a worker)
+bool ThreadPool::take_job(int index, Job &job) {
+  unsigned n = unsigned(m_workers.size());
+  unsigned start = index >= 0 ? unsigned(index) : m_next_queue % n;
+  for (unsigned i = 0; i < n; i++) {
+    unsigned queue = (start + i) % n;
+    Worker *worker = m_workers[queue].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (worker->jobs.empty()) {
+      continue;
+    }
+    if (int(queue) == index) {
+      job = std::move(worker->jobs.back());
+      worker->jobs.pop_back();
+    } else {
+      job = std::move(worker->jobs.front());
+      worker->jobs.pop_front();
+    }
+    m_num_queued--;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::worker_loop(int index) {
+  t_pool = this;
+  t_worker_index = index;
+  for (;;) {
+    Job job;
+    if (take_job(index, job)) {
+      job();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_work_available.wait(lock, [this] { return m_num_queued > 0 || m_stopping; });
+    if (m_stopping && m_num_queued == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A work-stealing pool of threads for running jobs (such as tasks
+// spawned by a program). Each worker has its own queue of jobs: jobs
+// submitted by a worker go on its own queue, and are run newest
+// first, and a worker with nothing to do takes the oldest job from
+// another worker's queue. Threads waiting for a job to finish can
+// help by running queued jobs themselves (see run_pending()).
+class ThreadPool {
+public:
+  typedef std::function<void()> Job;
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> m_workers;
+  // jobs in the queues (only increased while m_mutex is held, so
+  // that idle workers can't miss a new job)
+  std::atomic<size_t> m_num_queued;
+  // the queue that the next job submitted by a thread that isn't
+  // a worker goes on
+  std::atomic<unsigned> m_next_queue;
+  std::mutex m_mutex;
+  std::condition_variable m_work_available;
+  bool m_stopping;
+
+  // value semantics prohibited
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+
+public:
+  ThreadPool(unsigned num_threads);
+  // waits for the queued jobs to be run
+  ~ThreadPool();
+
+  // The pool shared by the whole process, with a worker per core
+  static ThreadPool *get_shared();
+
+  unsigned get_num_threads() const { return unsigned(m_workers.size()); }
+
+  void submit(Job job);
+
+  // Run one queued job on the calling thread, if there are any.
+  // Returns false if there were none.
+  bool run_pending();
+
+private:
+  int get_worker_index() const;
+  bool take_job(int index, Job &job);
+  void worker_loop(int index);
+};
+
+#endif // THREAD_POOL_H
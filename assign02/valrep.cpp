@@ -2,10 +2,13 @@
 #include "valrep.h"
 #include "string.h"
 #include "array.h"
+#include "map.h"
+#include "file.h"
+#include "task.h"
 
-ValRep::ValRep(ValRepKind kind)
-  : m_kind(kind)
-  , m_refcount(0) {
+ValRep::ValRep(ValRepKind kind, size_t size)
+  : m_kind(kind) {
+  Heap::get_current()->add(this, size);
 }
 
 ValRep::~ValRep() {
@@ -24,4 +27,19 @@ String *ValRep::as_string() {
 Array *ValRep::as_array() {
   assert(m_kind == VALREP_ARRAY);
   return static_cast<Array *>(this);
-}
\ No newline at end of file
+}
+
+Map *ValRep::as_map() {
+  assert(m_kind == VALREP_MAP);
+  return static_cast<Map *>(this);
+}
+
+File *ValRep::as_file() {
+  assert(m_kind == VALREP_FILE);
+  return static_cast<File *>(this);
+}
+
+Task *ValRep::as_task() {
+  assert(m_kind == VALREP_TASK);
+  return static_cast<Task *>(this);
+}
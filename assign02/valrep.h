@@ -2,49 +2,47 @@
 #define VALREP_H
 
 #include <cassert>
+#include <cstddef>
+#include "gc.h"
 class Function;
 class String;
 class Array;
+class Map;
+class File;
+class Task;
 
 // A "ValRep" (value representation) is a type used as
 // a dynamically-allocated object serving as the representation
-// of a Value. ValReps are reference counted, so many Values
-// can point to the same ValRep.
+// of a Value. Many Values can point to the same ValRep: ValReps
+// are garbage collected (see Heap), so copying a Value is just
+// copying a pointer.
 
 enum ValRepKind {
   VALREP_FUNCTION,
   VALREP_STRING,
-  VALREP_ARRAY
+  VALREP_ARRAY,
+  VALREP_MAP,
+  VALREP_FILE,
+  VALREP_TASK
   // other kinds of valreps (e.g., vector, string, etc.) could be added
 };
 
-class ValRep {
+class ValRep : public GCObject {
 private:
   ValRepKind m_kind;
-  int m_refcount;
 
   // copy constructor and assignment operator prohibited
   ValRep(const ValRep &);
   ValRep &operator=(const ValRep &);
 
 public:
-  ValRep(ValRepKind kind);
+  // The new object is added to the current Heap; size is roughly
+  // how many bytes it uses (which determines when to collect)
+  ValRep(ValRepKind kind, size_t size);
   virtual ~ValRep();
 
   ValRepKind get_kind() const { return m_kind; }
 
-  // These member functions allow reference counting of objects
-  // derived from ValRep.  add_ref() should be called when a
-  // Value is set to point to a ValRep. remove_ref() should be
-  // called when a Value no longer points to a ValRep.
-  // If remove_ref() is called and the reference count
-  // (as returned by get_num_refs()) becomes 0, the ValRep object
-  // should be deleted (because there are no longer any Value
-  // objects pointing to it.)
-  void add_ref()           { ++m_refcount; }
-  void remove_ref()        { assert(m_refcount > 0); --m_refcount; }
-  int get_num_refs() const { return m_refcount; }
-
   // It's useful to have functions that return a pointer to
   // the actual derived type (e.g., Function). Obviously, the caller
   // should only do this after checking the ValRepKind value
@@ -53,6 +51,12 @@ public:
   String *as_string();
 
   Array *as_array();
+
+  Map *as_map();
+
+  File *as_file();
+
+  Task *as_task();
 };
 
 #endif
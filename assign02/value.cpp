@@ -5,122 +5,132 @@
 #include "value.h"
 #include "string.h"
 #include "array.h"
+#include "map.h"
+#include "file.h"
+#include "task.h"
 
-Value::Value(int ival)
-  : m_kind(VALUE_INT) {
-  m_atomic.ival = ival;
+Value::Value(Function *fn) {
+  set_rep(VALUE_FUNCTION, fn);
 }
 
-Value::Value(Function *fn)
-  : m_kind(VALUE_FUNCTION)
-  , m_rep(fn) {
-  m_rep = fn;
-  fn->add_ref();
+Value::Value(const Intrinsic *intrinsic)
+  : m_bits((uint64_t(reinterpret_cast<uintptr_t>(intrinsic)) << TAG_BITS) | VALUE_INTRINSIC_FN) {
+  assert(get_intrinsic() == intrinsic);
 }
 
-Value::Value(IntrinsicFn intrinsic_fn)
-  : m_kind(VALUE_INTRINSIC_FN) {
-  m_atomic.intrinsic_fn = intrinsic_fn;
+Value::Value(String* string) {
+  set_rep(VALUE_STRING, string);
 }
 
-Value::Value(String* string)
-  : m_kind(VALUE_STRING)
-  , m_rep(string) {
-    m_rep->add_ref();
-  }
+Value::Value(Array* arr) {
+  set_rep(VALUE_ARRAY, arr);
+}
 
-Value::Value(Array* arr)
-  : m_kind(VALUE_ARRAY)
-  , m_rep(arr) {
-    m_rep->add_ref();
-  }
+Value::Value(Map *map) {
+  set_rep(VALUE_MAP, map);
+}
 
-Value::Value(const Value &other)
-  : m_kind(VALUE_INT) {
-  // Just use the assignment operator to copy the other Value's data
-  *this = other;
+Value::Value(File *file) {
+  set_rep(VALUE_FILE, file);
 }
 
-Value::~Value() {
-  // handle reference counting (detach from ValRep, if any)
+Value::Value(Task *task) {
+  set_rep(VALUE_TASK, task);
+}
 
-  if (m_kind >= VALUE_FUNCTION) {
-    m_rep->remove_ref();
-    if (m_rep->get_num_refs() == 0) {
-      delete m_rep;
-    }
+void Value::set_rep(ValueKind kind, ValRep *rep) {
+  assert((reinterpret_cast<uintptr_t>(rep) & TAG_MASK) == 0);
+  m_bits = uint64_t(reinterpret_cast<uintptr_t>(rep)) | kind;
+}
+
+bool Value::all_int(const Value *vals, size_t n) {
+  uint64_t tags = 0;
+  for (size_t i = 0; i < n; i++) {
+    tags |= vals[i].m_bits;
+  }
+  return (tags & TAG_MASK) == 0;
+}
+
+int Value::sum_ints(const Value *vals, size_t n) {
+  // unsigned, so that overflow wraps like the + operator
+  uint32_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += uint32_t(vals[i].m_bits >> 32);
   }
+  return int32_t(sum);
 }
 
-Value &Value::operator=(const Value &rhs) {
-  if (this != &rhs &&
-      !(is_dynamic() && rhs.is_dynamic() && m_rep == rhs.m_rep)) {
-    // handle reference counting (detach from previous ValRep, if any)
-    if (m_kind >= VALUE_FUNCTION) {
-      m_rep->remove_ref();
-      if (m_rep->get_num_refs() == 0) {
-        delete m_rep;
-      }
+long Value::find_identical(const Value *vals, size_t n, const Value &val) {
+  // check whole blocks of values with one branch per block (the
+  // compares can be vectorized where there is a 64 bit vector
+  // compare), then search the block containing the first match
+  const size_t BLOCK = 8;
+  size_t i = 0;
+  for (; i + BLOCK <= n; i += BLOCK) {
+    uint64_t matches = 0;
+    for (size_t j = 0; j < BLOCK; j++) {
+      matches |= uint64_t(vals[i + j].m_bits == val.m_bits);
+    }
+    if (matches != 0) {
+      break;
     }
-    m_kind = rhs.m_kind;
-    if (is_dynamic()) {
-      // attach to rhs's dynamic representation
-      m_rep = rhs.m_rep;
-      // handle reference counting (attach to the new ValRep)
-      m_rep->add_ref();
-    } else {
-      // copy rhs's atomic representation
-      m_atomic = rhs.m_atomic;
+  }
+  for (; i < n; i++) {
+    if (vals[i].m_bits == val.m_bits) {
+      return long(i);
     }
   }
-  return *this;
+  return -1;
 }
 
 Function *Value::get_function() const {
-  assert(m_kind == VALUE_FUNCTION);
-  return m_rep->as_function();
+  assert(get_kind() == VALUE_FUNCTION);
+  return get_rep()->as_function();
 }
 
 Array *Value::get_array() const {
-  assert(m_kind == VALUE_ARRAY);
-  return m_rep->as_array();
+  assert(get_kind() == VALUE_ARRAY);
+  return get_rep()->as_array();
+}
+Map *Value::get_map() const {
+  assert(get_kind() == VALUE_MAP);
+  return get_rep()->as_map();
+}
+File *Value::get_file() const {
+  assert(get_kind() == VALUE_FILE);
+  return get_rep()->as_file();
 }
+Task *Value::get_task() const {
+  assert(get_kind() == VALUE_TASK);
+  return get_rep()->as_task();
+}
+
 String *Value::get_string() const {
-  assert(m_kind == VALUE_STRING);
-  return m_rep->as_string();
+  assert(get_kind() == VALUE_STRING);
+  return get_rep()->as_string();
 }
 
 std::string Value::as_str() const {
-  switch (m_kind) {
+  switch (get_kind()) {
   case VALUE_INT:
-    return cpputil::format("%d", m_atomic.ival);
+    return cpputil::format("%d", get_ival());
   case VALUE_FUNCTION:
-    return cpputil::format("<function %s>", m_rep->as_function()->get_name().c_str());
+    return cpputil::format("<function %s>", get_rep()->as_function()->get_name().c_str());
   case VALUE_INTRINSIC_FN:
     return "<intrinsic function>";
   case VALUE_STRING:
-    return cpputil::format("%s", m_rep->as_string()->get_text().c_str());
-  case VALUE_ARRAY: {
-    std::string cur = "[";
-
-    auto arr = m_rep->as_array();
-
-    auto arr_vector=arr->get_array();
-
-    for (auto i = arr_vector.cbegin(); i != arr_vector.cend(); ++i) {
-      cur += (*i).as_str();
-      if ( (i + 1) != arr_vector.cend() ) {
-        cur += ", ";
-      }
-    }
-
-    cur +="]";
-
-    return cpputil::format("%s", cur.c_str());    
-  }
+    return get_rep()->as_string()->get_text();
+  case VALUE_ARRAY:
+    return get_rep()->as_array()->as_str();
+  case VALUE_MAP:
+    return get_rep()->as_map()->as_str();
+  case VALUE_FILE:
+    return get_rep()->as_file()->as_str();
+  case VALUE_TASK:
+    return "<task>";
   default:
     // this should not happen
-    RuntimeError::raise("Unknown value type %d", int(m_kind));
+    RuntimeError::raise("Unknown value type %d", int(get_kind()));
   }
 }
 
@@ -2,11 +2,18 @@
 #define VALUE_H
 
 #include <cassert>
+#include <cstdint>
 #include <string>
+#include <type_traits>
+#include "valrep.h"
 class ValRep;
 class Function;
 class String;
 class Array;
+class Map;
+class File;
+class Task;
+struct Intrinsic;
 
 enum ValueKind {
   // "atomic" values
@@ -19,7 +26,11 @@ enum ValueKind {
   VALUE_FUNCTION,
   VALUE_STRING,
   VALUE_ARRAY,
-  // could add other kinds of dynamic values here
+  VALUE_MAP,
+  VALUE_FILE,
+  VALUE_TASK,
+  // (the kind is stored in the low 3 bits of a Value,
+  // so there can't be more kinds)
 };
 
 // Typedef of the signature of an intrinsic function.
@@ -30,67 +41,108 @@ class Location;
 class Interpreter;
 typedef Value (*IntrinsicFn)(Value args[], unsigned num_args, const Location &loc, Interpreter *interp);
 
-// An "atomic" value that doesn't require a separate
-// (dynamically-allocated) representation
-union Atomic {
-  int ival;
-  IntrinsicFn intrinsic_fn;
-};
-
 // An instance of Value is a runtime value.
 // Its type can vary (int, function, intrinsic function, etc.)
+//
+// A Value is a single 64-bit word. The low TAG_BITS bits hold the
+// ValueKind, and the rest holds the data:
+//   - an int is stored (unboxed) in the upper 32 bits
+//   - an intrinsic function is a pointer to its (static) Intrinsic
+//     registry entry, shifted left past the tag
+//   - a dynamic value is a pointer to its ValRep, which is always
+//     at least 8 byte aligned, so the tag can share the low bits
+// Since an int's tag is 0, Value(0) is the all-zero word. Dynamic
+// values are garbage collected (see Heap), so copying, moving and
+// destroying any Value is trivial.
 
 class Value {
 private:
-  ValueKind m_kind;
-  union {
-    Atomic m_atomic; // for "atomic" values
-    ValRep *m_rep;   // for "dynamic" values (pointer to associated ValRep object)
-  };
+  uint64_t m_bits;
+
+  static const unsigned TAG_BITS = 3;
+  static const uint64_t TAG_MASK = (uint64_t(1) << TAG_BITS) - 1;
 
 public:
-  Value(int ival = 0);
+  Value(int ival = 0)
+    : m_bits(uint64_t(uint32_t(ival)) << 32) { }
   Value(Function *fn);
   Value(String *string);
   Value(Array* arr);
-  Value(IntrinsicFn intrinsic_fn);
-  
-  Value(const Value &other);
-  ~Value();
+  Value(Map *map);
+  Value(File *file);
+  Value(Task *task);
+  Value(const Intrinsic *intrinsic);
 
-  Value &operator=(const Value &rhs);
+  Value(const Value &other) = default;
+  Value &operator=(const Value &rhs) = default;
 
-  ValueKind get_kind() const { return m_kind; }
+  ValueKind get_kind() const { return ValueKind(m_bits & TAG_MASK); }
 
   // Getters to extract the contents of a Value.
   // The caller should use get_kind() first to determine
   // what kind of data the Value is storing.
 
   int get_ival() const {
-    assert(m_kind == VALUE_INT);
-    return m_atomic.ival;
+    assert(get_kind() == VALUE_INT);
+    return int32_t(m_bits >> 32);
   }
 
   Function *get_function() const;
 
-  IntrinsicFn get_intrinsic_fn() const {
-    assert(m_kind == VALUE_INTRINSIC_FN);
-    return m_atomic.intrinsic_fn;
+  const Intrinsic *get_intrinsic() const {
+    assert(get_kind() == VALUE_INTRINSIC_FN);
+    return reinterpret_cast<const Intrinsic *>(uintptr_t(m_bits >> TAG_BITS));
   }
 
   Array *get_array() const;
+  Map *get_map() const;
+  File *get_file() const;
+  Task *get_task() const;
   // convert to a string representation
   std::string as_str() const;
 
   String *get_string() const;
   
 
-  bool is_numeric() const { return m_kind == VALUE_INT; }
-  bool is_dynamic() const { return m_kind >= VALUE_FUNCTION; }
+  bool is_numeric() const { return get_kind() == VALUE_INT; }
+  bool is_dynamic() const { return get_kind() >= VALUE_FUNCTION; }
   bool is_atomic() const  { return !is_dynamic(); }
 
+  // True if both a and b are ints (checked with a single test,
+  // since the int tag is 0)
+  static bool both_int(const Value &a, const Value &b) {
+    return ((a.m_bits | b.m_bits) & TAG_MASK) == 0;
+  }
+
+  // True if a and b are the same int, or refer to the same object
+  static bool identical(const Value &a, const Value &b) { return a.m_bits == b.m_bits; }
+
+  // Orders ints: an int's value is in the high half of the word
+  // (with the tag, 0, below it), so the words compare the same way
+  static bool int_less(const Value &a, const Value &b) {
+    return int64_t(a.m_bits) < int64_t(b.m_bits);
+  }
+
+  // Bulk operations on a run of n values, written as loops over the
+  // words that the compiler can vectorize
+  static bool all_int(const Value *vals, size_t n);
+  // the (wrapping) sum of n ints
+  static int sum_ints(const Value *vals, size_t n);
+  // the index of the first value identical to val, or -1
+  static long find_identical(const Value *vals, size_t n, const Value &val);
+
 private:
-  // TODO: add additional member functions, if necessary
+  friend class Heap;
+  friend class ValueCopier;
+  friend class SnapshotWriter;
+
+  ValRep *get_rep() const {
+    return reinterpret_cast<ValRep *>(uintptr_t(m_bits & ~TAG_MASK));
+  }
+  void set_rep(ValueKind kind, ValRep *rep);
 };
 
+static_assert(sizeof(Value) == 8, "a Value should be a single 64 bit word");
+static_assert(std::is_trivially_copyable<Value>::value, "copying a Value should just copy its word");
+
 #endif // VALUE_H
@@ -0,0 +1,189 @@
+#include <cassert>
+#include "array.h"
+#include "environment.h"
+#include "file.h"
+#include "function.h"
+#include "gc.h"
+#include "map.h"
+#include "node.h"
+#include "string.h"
+#include "task.h"
+#include "value_copier.h"
+
+ValueCopier::ValueCopier()
+  : m_globals(nullptr)
+  , m_globals_copy(nullptr) {
+}
+
+ValueCopier::~ValueCopier() {
+}
+
+Value ValueCopier::copy(const Value &val) {
+  Value result = start_copy(val);
+  finish_copies();
+  return result;
+}
+
+Environment *ValueCopier::copy_env(Environment *env) {
+  Environment *result = start_copy_env(env);
+  finish_copies();
+  return result;
+}
+
+Environment *ValueCopier::copy_globals(Environment *global_env) {
+  assert(m_globals == nullptr && find_copy(global_env) == nullptr);
+  m_globals = global_env;
+  m_globals_copy = Environment::create(nullptr, global_env->get_num_slots());
+  m_global_copied.assign(global_env->get_num_slots(), false);
+  // (the copy has no contents to fill in now)
+  add_copy(global_env, m_globals_copy, false);
+  return m_globals_copy;
+}
+
+// Copy a value's object (if it hasn't been copied already), leaving
+// the objects it refers to for finish_copies()
+Value ValueCopier::start_copy(const Value &val) {
+  if (!val.is_dynamic() || Heap::is_pinned(val.get_rep())) {
+    return val;
+  }
+  GCObject *done = find_copy(val.get_rep());
+  if (done != nullptr) {
+    Value result;
+    result.set_rep(val.get_kind(), static_cast<ValRep *>(done));
+    return result;
+  }
+
+  switch (val.get_kind()) {
+  case VALUE_STRING: {
+    String *str = val.get_string()->copy();
+    add_copy(val.get_rep(), str, false);
+    return Value(str);
+  }
+
+  case VALUE_ARRAY: {
+    // (the elements are replaced by copies later)
+    Array *arr = val.get_array()->copy_elements();
+    add_copy(val.get_rep(), arr, !arr->is_packed());
+    return Value(arr);
+  }
+
+  case VALUE_MAP: {
+    Map *map = new Map();
+    add_copy(val.get_rep(), map, true);
+    return Value(map);
+  }
+
+  case VALUE_FUNCTION: {
+    Function *orig = val.get_function();
+    Environment *env = start_copy_env(orig->get_parent_env());
+    // copying the environment may have copied the function
+    done = find_copy(orig);
+    if (done != nullptr) {
+      return Value(static_cast<Function *>(done));
+    }
+    Function *fn = new Function(orig->get_name(), orig->get_params(), env, orig->get_body());
+    fn->set_chunk(orig->get_chunk());
+    add_copy(orig, fn, false);
+    if (env == m_globals_copy) {
+      copy_global_refs(orig);
+    }
+    return Value(fn);
+  }
+
+  case VALUE_FILE: {
+    File *file = val.get_file()->copy();
+    add_copy(val.get_rep(), file, false);
+    return Value(file);
+  }
+
+  case VALUE_TASK: {
+    Task *task = val.get_task()->copy();
+    add_copy(val.get_rep(), task, false);
+    return Value(task);
+  }
+
+  default:
+    assert(false);
+    return val;
+  }
+}
+
+Environment *ValueCopier::start_copy_env(Environment *env) {
+  if (env == nullptr) {
+    return nullptr;
+  }
+  GCObject *done = find_copy(env);
+  if (done == nullptr) {
+    Environment *parent = start_copy_env(env->get_parent());
+    done = find_copy(env);
+    if (done == nullptr) {
+      done = Environment::create(parent, env->get_num_slots());
+      add_copy(env, done, true);
+    }
+  }
+  return static_cast<Environment *>(done);
+}
+
+// Fill in the contents of the arrays, maps and environments copied
+// so far (which may copy more of them)
+void ValueCopier::finish_copies() {
+  while (!m_pending.empty() || !m_pending_globals.empty()) {
+    if (!m_pending_globals.empty()) {
+      int slot = m_pending_globals.back();
+      m_pending_globals.pop_back();
+      m_globals_copy->get_slot(unsigned(slot)) = start_copy(m_globals->get_slot(unsigned(slot)));
+      continue;
+    }
+
+
+    Pending pending = m_pending.back();
+    m_pending.pop_back();
+
+    if (Environment *env = dynamic_cast<Environment *>(pending.copy)) {
+      Environment *orig = const_cast<Environment *>(static_cast<const Environment *>(pending.orig));
+      for (unsigned i = 0; i < env->get_num_slots(); i++) {
+        env->get_slot(i) = start_copy(orig->get_slot(i));
+      }
+      continue;
+    }
+
+    ValRep *rep = static_cast<ValRep *>(pending.copy);
+    if (rep->get_kind() == VALREP_ARRAY) {
+      Array *arr = rep->as_array();
+      for (int i = 0; i < arr->len(); i++) {
+        arr->set_val(start_copy(arr->get_val(i)), i);
+      }
+    } else {
+      Map *map = rep->as_map();
+      const Map *orig = static_cast<const Map *>(pending.orig);
+      orig->for_each([this, map](const Value &key, const Value &val) {
+        map->put(start_copy(key), start_copy(val));
+      });
+    }
+  }
+}
+
+// Queue the global variables a Function's body refers to (which
+// haven't been copied already) to be copied
+void ValueCopier::copy_global_refs(const Function *fn) {
+  const std::vector<int> &slots = fn->get_body()->get_global_refs();
+  for (auto i = slots.begin(); i != slots.end(); ++i) {
+    if (!m_global_copied[*i]) {
+      m_global_copied[*i] = true;
+      m_pending_globals.push_back(*i);
+    }
+  }
+}
+
+GCObject *ValueCopier::find_copy(const GCObject *orig) const {
+  auto i = m_copies.find(orig);
+  return i != m_copies.end() ? i->second : nullptr;
+}
+
+void ValueCopier::add_copy(const GCObject *orig, GCObject *copy, bool has_contents) {
+  m_copies.emplace(orig, copy);
+  if (has_contents) {
+    Pending pending = { orig, copy };
+    m_pending.push_back(pending);
+  }
+}
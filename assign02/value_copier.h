@@ -0,0 +1,64 @@
+#ifndef VALUE_COPIER_H
+#define VALUE_COPIER_H
+
+#include <unordered_map>
+#include <vector>
+#include "value.h"
+class GCObject;
+class Environment;
+class Function;
+
+// A ValueCopier copies values, and everything they refer to, in to
+// the current heap, so that another thread can use them (see Task).
+// An object that is reached more than once (through cycles too) is
+// copied once per ValueCopier. Pinned Strings are immutable and live
+// as long as the program, so they are shared rather than copied.
+//
+// The copies of arrays, maps and environments are created first, and
+// their contents copied afterwards, so that long chains of them don't
+// recurse deeply.
+//
+// The global environment can be copied lazily (see copy_globals()):
+// only the global variables that the copied Functions refer to are
+// copied, so a task doesn't pay for globals it can't use.
+class ValueCopier {
+private:
+  struct Pending {
+    const GCObject *orig;
+    GCObject *copy;
+  };
+
+  std::unordered_map<const GCObject *, GCObject *> m_copies;
+  std::vector<Pending> m_pending;
+  // the global environment being copied lazily, its copy, which of
+  // its slots have been copied, and slots waiting to be copied
+  Environment *m_globals;
+  Environment *m_globals_copy;
+  std::vector<bool> m_global_copied;
+  std::vector<int> m_pending_globals;
+
+  // value semantics prohibited
+  ValueCopier(const ValueCopier &);
+  ValueCopier &operator=(const ValueCopier &);
+
+public:
+  ValueCopier();
+  ~ValueCopier();
+
+  Value copy(const Value &val);
+  Environment *copy_env(Environment *env);
+  // Copy a global environment with all of its variables 0, except
+  // for the ones used by Functions copied (by this ValueCopier)
+  // afterwards. Functions have to be defined in the global scope.
+  Environment *copy_globals(Environment *global_env);
+
+private:
+  Value start_copy(const Value &val);
+  Environment *start_copy_env(Environment *env);
+  void finish_copies();
+  void copy_global_refs(const Function *fn);
+  GCObject *find_copy(const GCObject *orig) const;
+  void add_copy(const GCObject *orig, GCObject *copy, bool has_contents);
+};
+
+#endif // VALUE_COPIER_H
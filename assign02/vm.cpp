@@ -0,0 +1,463 @@
+#include <cassert>
+#include <utility>
+#include "bytecode.h"
+#include "environment.h"
+#include "exceptions.h"
+#include "frame_arena.h"
+#include "function.h"
+#include "gc.h"
+#include "intrinsic.h"
+#include "interp.h"
+#include "node.h"
+#include "vm.h"
+
+// The dispatch loop uses "computed goto" (a GNU extension) when it is
+// available, so that each instruction jumps directly to the handler
+// for the next one. Otherwise it falls back to a switch statement.
+#if defined(__GNUC__)
+#  define VM_THREADED_DISPATCH
+#endif
+
+namespace {
+
+// Raise the error for a binary operator whose operands are
+// not both integers
+void raise_operand_error(Node *node, const Value &lhs) {
+  if (lhs.get_kind() != VALUE_INT) {
+    EvaluationError::raise(node->get_kid(0)->get_loc(), "Invalid type.");
+  }
+  EvaluationError::raise(node->get_kid(1)->get_loc(), "Invalid type.");
+}
+
+}
+
+VM::VM(Interpreter *interp, Program *program)
+  : m_interp(interp)
+  , m_program(program)
+  , m_gc_sp(nullptr)
+  , m_gc_env(nullptr) {
+}
+
+VM::~VM() {
+}
+
+// Make sure that there is room for at least needed more values
+// above sp, returning the (possibly moved) stack pointer
+Value *VM::grow_stack(Value *sp, int needed) {
+  size_t used = size_t(sp - m_stack.data());
+  if (used + needed > m_stack.size()) {
+    m_stack.resize((used + needed) * 2);
+    sp = m_stack.data() + used;
+  }
+  return sp;
+}
+
+// Call the intrinsic function at callee with the num_args arguments
+// above it on the stack
+Value VM::call_intrinsic(Value *callee, int num_args, Node *node) {
+  if (callee->get_kind() != VALUE_INTRINSIC_FN) {
+    EvaluationError::raise(node->get_loc(), "%s is not a function", node->get_kid(0)->get_str().c_str());
+  }
+
+  return callee->get_intrinsic()->call(callee + 1, unsigned(num_args), node->get_loc(), m_interp);
+}
+
+// Release the environments of a call: the body's environment
+// and the parameter environment above it
+void VM::release_call_envs(Environment *body_env) {
+  Environment *param_env = body_env->get_parent();
+  Environment::release(body_env);
+  Environment::release(param_env);
+}
+
+void VM::mark_roots(Heap &heap) const {
+  for (const Value *p = m_stack.data(); p < m_gc_sp; ++p) {
+    heap.mark_value(*p);
+  }
+  heap.mark(m_gc_env);
+  for (auto i = m_frames.begin(); i != m_frames.end(); ++i) {
+    heap.mark(i->env);
+  }
+}
+
+Value VM::run(Environment *global_env) {
+  m_frames.clear();
+  m_stack.clear();
+
+  Chunk *chunk = m_program->get_chunk(0);
+  Value *sp = grow_stack(m_stack.data(), chunk->get_max_stack() + 1);
+  return execute(chunk, global_env, global_env, sp);
+}
+
+Value VM::call(Environment *global_env, const Value &fn_val, const Value args[], unsigned num_args) {
+  m_frames.clear();
+  m_stack.clear();
+
+  // the function value and arguments go on the stack, as they would
+  // for OP_CALL, below a frame that returns from execute()
+  Value *callee = grow_stack(m_stack.data(), int(num_args) + 1);
+  callee[0] = fn_val;
+  for (unsigned i = 0; i < num_args; i++) {
+    callee[i + 1] = args[i];
+  }
+  Frame frame = { nullptr, nullptr, global_env, 0 };
+  m_frames.push_back(frame);
+
+  Function *fn = fn_val.get_function();
+  Chunk *chunk = fn->get_chunk();
+  FrameArena *arena = chunk->frame_escapes() ? nullptr : m_interp->get_frame_arena();
+  Environment *param_env = Environment::create(fn->get_parent_env(), num_args, arena);
+  for (unsigned i = 0; i < num_args; i++) {
+    param_env->get_slot(i) = callee[i + 1];
+  }
+  Environment *env = Environment::create(param_env, unsigned(chunk->get_num_locals()), arena);
+  Value *sp = grow_stack(callee + 1, chunk->get_max_stack());
+  return execute(chunk, env, global_env, sp);
+}
+
+Value VM::execute(Chunk *chunk, Environment *env, Environment *global_env, Value *sp) {
+  Value *globals = &global_env->get_slot(0);
+  FrameArena *arena = m_interp->get_frame_arena();
+  Heap *heap = m_interp->get_heap();
+  const int *pc = chunk->get_code();
+
+  // Garbage is only collected at calls and jumps (so every loop
+  // and every recursion polls), when everything the program can
+  // still use is on the stack or reachable from an environment
+#define GC_POLL()                                            \
+  if (heap->should_collect()) {                              \
+    m_gc_sp = sp;                                            \
+    m_gc_env = env;                                          \
+    m_interp->collect_garbage();                             \
+  }
+
+#define INT_BINARY_OP(op, expr)                              \
+  TARGET(op): {                                              \
+    Value &lhs = sp[-2], &rhs = sp[-1];                      \
+    if (!Value::both_int(lhs, rhs)) {                        \
+      raise_operand_error(chunk->get_node(pc[1]), lhs);      \
+    }                                                        \
+    int a = lhs.get_ival(), b = rhs.get_ival();              \
+    lhs = Value(expr);                                       \
+    --sp;                                                    \
+    pc += 2;                                                 \
+    DISPATCH();                                              \
+  }
+
+#ifdef VM_THREADED_DISPATCH
+  static void *const s_labels[] = {
+    &&L_OP_INT, &&L_OP_CONST, &&L_OP_POP, &&L_OP_LOAD, &&L_OP_LOAD_LOCAL,
+    &&L_OP_LOAD_GLOBAL, &&L_OP_STORE, &&L_OP_STORE_LOCAL, &&L_OP_STORE_GLOBAL,
+    &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV,
+    &&L_OP_LT, &&L_OP_LTE, &&L_OP_GT, &&L_OP_GTE, &&L_OP_EQ, &&L_OP_NE,
+    &&L_OP_AND, &&L_OP_OR, &&L_OP_TRUTH, &&L_OP_JUMP, &&L_OP_JUMP_IF_FALSE,
+    &&L_OP_ENTER_SCOPE, &&L_OP_LEAVE_SCOPE, &&L_OP_FUNC, &&L_OP_CALL,
+    &&L_OP_RETURN, &&L_OP_CALL_INTRINSIC1, &&L_OP_CALL_INTRINSIC2,
+    &&L_OP_CALL_INTRINSIC3, &&L_OP_TAIL_CALL,
+  };
+  static_assert(sizeof(s_labels) / sizeof(s_labels[0]) == NUM_OPCODES,
+                "every opcode needs a dispatch label");
+#  define TARGET(op) L_##op
+#  define DISPATCH() goto *s_labels[*pc]
+  DISPATCH();
+#else
+#  define TARGET(op) case op
+#  define DISPATCH() goto dispatch
+dispatch:
+  switch (*pc) {
+#endif
+
+  TARGET(OP_INT):
+    *sp++ = Value(pc[1]);
+    pc += 2;
+    DISPATCH();
+
+  TARGET(OP_CONST):
+    *sp++ = chunk->get_constant(pc[1]);
+    pc += 2;
+    DISPATCH();
+
+  TARGET(OP_POP):
+    --sp;
+    pc += 1;
+    DISPATCH();
+
+  TARGET(OP_LOAD):
+    *sp++ = env->lookup(pc[1], pc[2]);
+    pc += 3;
+    DISPATCH();
+
+  TARGET(OP_LOAD_LOCAL):
+    *sp++ = env->get_slot(unsigned(pc[1]));
+    pc += 2;
+    DISPATCH();
+
+  TARGET(OP_LOAD_GLOBAL):
+    *sp++ = globals[pc[1]];
+    pc += 2;
+    DISPATCH();
+
+  TARGET(OP_STORE):
+    env->lookup(pc[1], pc[2]) = sp[-1];
+    pc += 3;
+    DISPATCH();
+
+  TARGET(OP_STORE_LOCAL):
+    env->get_slot(unsigned(pc[1])) = sp[-1];
+    pc += 2;
+    DISPATCH();
+
+  TARGET(OP_STORE_GLOBAL):
+    globals[pc[1]] = sp[-1];
+    pc += 2;
+    DISPATCH();
+
+  INT_BINARY_OP(OP_ADD, a + b)
+  INT_BINARY_OP(OP_SUB, a - b)
+  INT_BINARY_OP(OP_MUL, a * b)
+
+  TARGET(OP_DIV): {
+    Value &lhs = sp[-2], &rhs = sp[-1];
+    Node *node = chunk->get_node(pc[1]);
+    if (!Value::both_int(lhs, rhs)) {
+      raise_operand_error(node, lhs);
+    }
+    if (rhs.get_ival() == 0) {
+      EvaluationError::raise(node->get_loc(), "Divide by zero error.");
+    }
+    lhs = Value(lhs.get_ival() / rhs.get_ival());
+    --sp;
+    pc += 2;
+    DISPATCH();
+  }
+
+  INT_BINARY_OP(OP_LT, a < b ? 1 : 0)
+  INT_BINARY_OP(OP_LTE, a <= b ? 1 : 0)
+  INT_BINARY_OP(OP_GT, a > b ? 1 : 0)
+  INT_BINARY_OP(OP_GTE, a >= b ? 1 : 0)
+  INT_BINARY_OP(OP_EQ, a == b ? 1 : 0)
+  INT_BINARY_OP(OP_NE, a != b ? 1 : 0)
+
+  TARGET(OP_AND):
+    if (sp[-1].get_kind() != VALUE_INT) {
+      EvaluationError::raise(chunk->get_node(pc[1])->get_kid(0)->get_loc(), "Invalid type.");
+    }
+    if (sp[-1].get_ival() == 0) {
+      pc = chunk->get_code() + pc[2];
+    } else {
+      --sp;
+      pc += 3;
+    }
+    DISPATCH();
+
+  TARGET(OP_OR):
+    if (sp[-1].get_kind() != VALUE_INT) {
+      EvaluationError::raise(chunk->get_node(pc[1])->get_kid(0)->get_loc(), "Invalid type.");
+    }
+    if (sp[-1].get_ival() == 1) {
+      pc = chunk->get_code() + pc[2];
+    } else {
+      --sp;
+      pc += 3;
+    }
+    DISPATCH();
+
+  TARGET(OP_TRUTH):
+    if (sp[-1].get_kind() != VALUE_INT) {
+      EvaluationError::raise(chunk->get_node(pc[1])->get_kid(1)->get_loc(), "Invalid type.");
+    }
+    sp[-1] = Value(sp[-1].get_ival() != 0);
+    pc += 2;
+    DISPATCH();
+
+  TARGET(OP_JUMP):
+    GC_POLL();
+    pc = chunk->get_code() + pc[1];
+    DISPATCH();
+
+  TARGET(OP_JUMP_IF_FALSE): {
+    --sp;
+    if (sp->get_kind() != VALUE_INT) {
+      EvaluationError::raise(chunk->get_node(pc[1])->get_loc(), "Invalid type.");
+    }
+    int cond = sp->get_ival();
+    pc = cond ? pc + 3 : chunk->get_code() + pc[2];
+    DISPATCH();
+  }
+
+  TARGET(OP_ENTER_SCOPE):
+    env = Environment::create(env, unsigned(pc[1]), pc[2] ? nullptr : arena);
+    pc += 3;
+    DISPATCH();
+
+  TARGET(OP_LEAVE_SCOPE): {
+    Environment *parent = env->get_parent();
+    Environment::release(env);
+    env = parent;
+    pc += 1;
+    DISPATCH();
+  }
+
+  TARGET(OP_FUNC): {
+    Chunk *fn_chunk = m_program->get_chunk(pc[1]);
+    Function *fn = new Function(fn_chunk->get_name(), fn_chunk->get_params(), env, fn_chunk->get_body());
+    fn->set_chunk(fn_chunk);
+    Value fn_val(fn);
+    env->get_slot(unsigned(pc[2])) = fn_val;
+    *sp++ = fn_val;
+    pc += 3;
+    DISPATCH();
+  }
+
+  TARGET(OP_CALL): {
+    int num_args = pc[1];
+    Value *callee = sp - num_args - 1;
+    Node *node = chunk->get_node(pc[2]);
+    GC_POLL();
+
+    if (callee->get_kind() == VALUE_FUNCTION) {
+      Function *fn = callee->get_function();
+      if (unsigned(num_args) != fn->get_num_params()) {
+        EvaluationError::raise(node->get_loc(), "Invalid number of parameters for %s", fn->get_name().c_str());
+      }
+
+      Chunk *fn_chunk = fn->get_chunk();
+      FrameArena *fn_arena = fn_chunk->frame_escapes() ? nullptr : arena;
+      Environment *param_env = Environment::create(fn->get_parent_env(), unsigned(num_args), fn_arena);
+      for (int i = 0; i < num_args; i++) {
+        param_env->get_slot(unsigned(i)) = std::move(callee[i + 1]);
+      }
+
+      Frame frame = { chunk, pc + 3, env, unsigned(callee - m_stack.data()) };
+      m_frames.push_back(frame);
+
+      chunk = fn_chunk;
+      env = Environment::create(param_env, unsigned(chunk->get_num_locals()), fn_arena);
+      pc = chunk->get_code();
+      sp = grow_stack(callee + 1, chunk->get_max_stack());
+      DISPATCH();
+    }
+
+    *callee = call_intrinsic(callee, num_args, node);
+    sp = callee + 1;
+    pc += 3;
+    DISPATCH();
+  }
+
+  TARGET(OP_RETURN): {
+    Value result = sp[-1];
+    if (m_frames.empty()) {
+      return result;
+    }
+
+    Frame &frame = m_frames.back();
+    Value *callee = m_stack.data() + frame.base;
+    *callee = result;
+    sp = callee + 1;
+    release_call_envs(env);
+    if (frame.chunk == nullptr) {
+      // the end of the function called by call()
+      m_frames.pop_back();
+      return result;
+    }
+
+    chunk = frame.chunk;
+    pc = frame.pc;
+    env = frame.env;
+    m_frames.pop_back();
+    DISPATCH();
+  }
+
+  // Calls bound to an intrinsic during analysis: the arguments are
+  // on the stack (without the function value below them), and only
+  // their kinds need to be checked
+  TARGET(OP_CALL_INTRINSIC1): {
+    Node *node = chunk->get_node(pc[1]);
+    const Intrinsic *intrinsic = node->get_intrinsic();
+    intrinsic->check_kinds(sp - 1, node->get_loc());
+    sp[-1] = intrinsic->fn1(sp[-1], node->get_loc(), m_interp);
+    pc += 2;
+    DISPATCH();
+  }
+
+  TARGET(OP_CALL_INTRINSIC2): {
+    Node *node = chunk->get_node(pc[1]);
+    const Intrinsic *intrinsic = node->get_intrinsic();
+    intrinsic->check_kinds(sp - 2, node->get_loc());
+    Value result = intrinsic->fn2(sp[-2], sp[-1], node->get_loc(), m_interp);
+    --sp;
+    sp[-1] = result;
+    pc += 2;
+    DISPATCH();
+  }
+
+  TARGET(OP_CALL_INTRINSIC3): {
+    Node *node = chunk->get_node(pc[1]);
+    const Intrinsic *intrinsic = node->get_intrinsic();
+    intrinsic->check_kinds(sp - 3, node->get_loc());
+    Value result = intrinsic->fn3(sp[-3], sp[-2], sp[-1], node->get_loc(), m_interp);
+    sp -= 2;
+    sp[-1] = result;
+    pc += 2;
+    DISPATCH();
+  }
+
+  TARGET(OP_TAIL_CALL): {
+    int num_args = pc[1];
+    Value *callee = sp - num_args - 1;
+    Node *node = chunk->get_node(pc[2]);
+    GC_POLL();
+    if (callee->get_kind() != VALUE_FUNCTION) {
+      // nothing to gain from a tail call to an intrinsic
+      *callee = call_intrinsic(callee, num_args, node);
+      sp = callee + 1;
+      pc += 4;
+      DISPATCH();
+    }
+
+    assert(!m_frames.empty());
+    Function *fn = callee->get_function();
+    if (unsigned(num_args) != fn->get_num_params()) {
+      EvaluationError::raise(node->get_loc(), "Invalid number of parameters for %s", fn->get_name().c_str());
+    }
+
+    // discard the current call's environments: the block scopes
+    // entered by the body, the body's environment, and the parameters
+    for (int i = pc[3]; i > 0; i--) {
+      Environment *parent = env->get_parent();
+      Environment::release(env);
+      env = parent;
+    }
+    release_call_envs(env);
+
+    Chunk *fn_chunk = fn->get_chunk();
+    FrameArena *fn_arena = fn_chunk->frame_escapes() ? nullptr : arena;
+    Environment *param_env = Environment::create(fn->get_parent_env(), unsigned(num_args), fn_arena);
+    for (int i = 0; i < num_args; i++) {
+      param_env->get_slot(unsigned(i)) = std::move(callee[i + 1]);
+    }
+
+    // the callee replaces the current function in the current frame
+    Value *base = m_stack.data() + m_frames.back().base;
+    *base = *callee;
+
+    chunk = fn_chunk;
+    env = Environment::create(param_env, unsigned(chunk->get_num_locals()), fn_arena);
+    pc = chunk->get_code();
+    sp = grow_stack(base + 1, chunk->get_max_stack());
+    DISPATCH();
+  }
+
+#ifndef VM_THREADED_DISPATCH
+  default:
+    assert(false);
+  }
+#endif
+
+#undef GC_POLL
+#undef INT_BINARY_OP
+#undef TARGET
+#undef DISPATCH
+
+  return Value();
+}
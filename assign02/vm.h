@@ -0,0 +1,58 @@
+#ifndef VM_H
+#define VM_H
+
+#include <vector>
+#include "value.h"
+class Chunk;
+class Program;
+class Environment;
+class Interpreter;
+class Node;
+class Heap;
+
+// The VM executes a compiled Program. Calls to user functions
+// do not recurse on the native stack: each call pushes a Frame.
+class VM {
+private:
+  struct Frame {
+    Chunk *chunk;         // the caller's chunk (null for call())
+    const int *pc;        // return address in the caller's chunk
+    Environment *env;     // the caller's environment
+    unsigned base;        // stack index of the called function value
+  };
+
+  Interpreter *m_interp;
+  Program *m_program;
+  std::vector<Value> m_stack;
+  std::vector<Frame> m_frames;
+  // the top of the stack and the current environment when
+  // a garbage collection was requested
+  Value *m_gc_sp;
+  Environment *m_gc_env;
+
+  // value semantics prohibited
+  VM(const VM &);
+  VM &operator=(const VM &);
+
+public:
+  VM(Interpreter *interp, Program *program);
+  ~VM();
+
+  // execute the top-level unit (chunk 0) in the given environment
+  Value run(Environment *global_env);
+  // call a user function (which must have been compiled, and must
+  // take num_args parameters) in a program whose global environment
+  // is global_env
+  Value call(Environment *global_env, const Value &fn_val, const Value args[], unsigned num_args);
+
+  // mark the values and environments in use by the running program
+  void mark_roots(Heap &heap) const;
+
+private:
+  Value execute(Chunk *chunk, Environment *env, Environment *global_env, Value *sp);
+  Value *grow_stack(Value *sp, int needed);
+  Value call_intrinsic(Value *callee, int num_args, Node *node);
+  static void release_call_envs(Environment *body_env);
+};
+
+#endif // VM_H